@@ -0,0 +1,28 @@
+#include <csignal>
+#include <iostream>
+
+#include "simulator/simulator.h"
+
+std::unique_ptr<obd2_sim::simulator> active_simulator;
+
+void handle_int(int signal);
+
+int main(int argc, char **argv) {
+    std::signal(SIGINT, handle_int);
+    std::signal(SIGTERM, handle_int);
+
+    try {
+        active_simulator = std::make_unique<obd2_sim::simulator>(argc > 1 ? argv[1] : "simulator.json");
+        active_simulator->run();
+    }
+    catch(const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}
+
+void handle_int(int signal) {
+    if (active_simulator) {
+        active_simulator->stop();
+    }
+}
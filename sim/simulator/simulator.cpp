@@ -0,0 +1,226 @@
+#include "simulator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+
+namespace obd2_sim {
+    const std::string simulator::DEFAULT_CAN_DEVICE         = "vcan0";
+    const std::string simulator::DEFAULT_VEHICLES_DIR       = "static/config/vehicles";
+    const uint32_t simulator::DEFAULT_SEED                  = 1;
+    const uint32_t simulator::DEFAULT_STATS_INTERVAL_MS     = 5000;
+
+    simulator::simulator(const std::string &config_path) {
+        load_config(config_path);
+
+        uint32_t loaded_vehicles = load_vehicles();
+
+        std::cout << "Loaded " << loaded_vehicles << " vehicle definitions" << std::endl;
+
+        for (const auto &ecu : ecus) {
+            std::cout << "Simulating ECU " << std::hex << std::uppercase << ecu.first << std::dec 
+                << " with " << ecu.second->get_pid_count() << " PIDs" << std::endl;
+        }
+    }
+
+    simulator::~simulator() {
+        stop();
+    }
+
+    void simulator::run() {
+        for (auto &ecu : ecus) {
+            ecu.second->start(can_device);
+        }
+
+        std::cout << "Answering requests on " << can_device << std::endl;
+
+        std::unique_lock<std::mutex> running_lock(running_mutex);
+        const auto interval = std::chrono::milliseconds(stats_interval_ms);
+        auto last_stats = std::chrono::steady_clock::now();
+
+        running = true;
+
+        while (running) {
+            running_cv.wait_for(running_lock, interval, [this] { return !running; });
+
+            auto now = std::chrono::steady_clock::now();
+            print_stats(std::chrono::duration_cast<std::chrono::milliseconds>(now - last_stats));
+            last_stats = now;
+        }
+
+        for (auto &ecu : ecus) {
+            ecu.second->stop();
+        }
+    }
+
+    void simulator::stop() {
+        {
+            std::lock_guard<std::mutex> running_lock(running_mutex);
+            running = false;
+        }
+
+        running_cv.notify_all();
+    }
+
+    void simulator::load_config(const std::string &config_path) {
+        std::ifstream file(config_path);
+
+        if (!file.is_open()) {
+            std::cout << "Could not open " << config_path << ", using defaults" << std::endl;
+            return;
+        }
+
+        nlohmann::json j = nlohmann::json::parse(file);
+        auto json_it = j.find("can_device");
+
+        if (json_it != j.end()) {
+            can_device = json_it->template get<std::string>();
+        }
+
+        if ((json_it = j.find("vehicles_dir")) != j.end()) {
+            vehicles_dir = json_it->template get<std::string>();
+        }
+
+        if ((json_it = j.find("seed")) != j.end()) {
+            seed = json_it->template get<uint32_t>();
+        }
+
+        if ((json_it = j.find("stats_interval_ms")) != j.end()) {
+            stats_interval_ms = json_it->template get<uint32_t>();
+        }
+
+        if ((json_it = j.find("default_ecu")) != j.end()) {
+            from_json(*json_it, default_ecu_config);
+        }
+
+        // ECU IDs are given as strings, e.g. "2016" or "0x7E0"
+        if ((json_it = j.find("ecus")) != j.end()) {
+            for (const auto &ecu : json_it->items()) {
+                ecu_config c = default_ecu_config;
+
+                from_json(ecu.value(), c);
+                ecu_configs[std::stoul(ecu.key(), nullptr, 0)] = c;
+            }
+        }
+    }
+
+    uint32_t simulator::load_vehicles() {
+        std::filesystem::path path(vehicles_dir);
+        uint32_t loaded = 0;
+
+        if (!std::filesystem::exists(path) || !std::filesystem::is_directory(path)) {
+            return 0;
+        }
+
+        for (const auto& entry : std::filesystem::directory_iterator(path)) {
+            if (!entry.is_regular_file() || entry.path().extension() != ".json") {
+                continue;
+            }
+
+            try {
+                obd2_server::vehicle v(entry.path().string());
+
+                for (const auto &r : v.get_requests()) {
+                    add_request(r);
+                }
+
+                loaded++;
+            }
+            catch (std::exception &e) {
+                std::cerr << "Could not load vehicle from " << entry.path().string() << ": " << e.what() << std::endl;
+            }
+        }
+
+        return loaded;
+    }
+
+    void simulator::add_request(const obd2_server::request &r) {
+        auto it = ecus.find(r.ecu);
+
+        if (it == ecus.end()) {
+            auto config_it = ecu_configs.find(r.ecu);
+            const ecu_config &c = config_it != ecu_configs.end() ? config_it->second : default_ecu_config;
+
+            it = ecus.try_emplace(r.ecu, std::make_unique<virtual_ecu>(r.ecu, c, seed)).first;
+        }
+
+        // The formula variables (A, B, ...) name the data bytes, the highest one gives the length
+        size_t length = 1;
+
+        for (char c : r.formula) {
+            if (c >= 'A' && c <= 'Z') {
+                length = std::max(length, static_cast<size_t>(c - 'A' + 1));
+            }
+        }
+
+        it->second->add_pid(r.service, r.pid, length);
+    }
+
+    void simulator::print_stats(std::chrono::milliseconds elapsed) {
+        double seconds = elapsed.count() / 1000.0;
+
+        for (const auto &ecu : ecus) {
+            uint64_t answered = ecu.second->get_answered();
+            double rate = seconds > 0 ? (answered - last_answered[ecu.first]) / seconds : 0;
+
+            std::cout << "ECU " << std::hex << std::uppercase << ecu.first << std::dec
+                << ": " << ecu.second->get_received() << " received, " 
+                << answered << " answered, "
+                << ecu.second->get_dropped() << " dropped, "
+                << std::fixed << std::setprecision(1) << rate << " responses/s" << std::endl;
+
+            last_answered[ecu.first] = answered;
+        }
+    }
+
+    void from_json(const nlohmann::json &j, ecu_config &c) {
+        auto json_it = j.find("latency_ms");
+
+        if (json_it != j.end()) {
+            c.latency_ms = json_it->template get<uint32_t>();
+        }
+
+        if ((json_it = j.find("jitter_ms")) != j.end()) {
+            c.jitter_ms = json_it->template get<uint32_t>();
+        }
+
+        if ((json_it = j.find("drop_rate")) != j.end()) {
+            c.drop_rate = json_it->template get<double>();
+        }
+
+        if ((json_it = j.find("block_size")) != j.end()) {
+            c.block_size = json_it->template get<uint8_t>();
+        }
+
+        if ((json_it = j.find("st_min")) != j.end()) {
+            c.st_min = json_it->template get<uint8_t>();
+        }
+
+        if ((json_it = j.find("vin")) != j.end()) {
+            c.vin = json_it->template get<std::string>();
+        }
+
+        if ((json_it = j.find("name")) != j.end()) {
+            c.name = json_it->template get<std::string>();
+        }
+
+        if ((json_it = j.find("dtcs")) != j.end()) {
+            c.dtcs = json_it->template get<std::vector<std::string>>();
+
+            // A system letter and 14 bits of hex digits, e.g. "P0301"
+            for (const auto &code : c.dtcs) {
+                bool valid = code.size() == 5 && std::string("PCBU").find(code[0]) != std::string::npos
+                    && code[1] >= '0' && code[1] <= '3'
+                    && std::all_of(code.begin() + 2, code.end(), [](char d) { return std::isxdigit(static_cast<unsigned char>(d)); });
+
+                if (!valid) {
+                    throw std::invalid_argument("Invalid DTC '" + code + "'");
+                }
+            }
+        }
+    }
+}
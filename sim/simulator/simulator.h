@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <json.hpp>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "../../src/server/vehicle/vehicle.h"
+#include "../virtual_ecu/virtual_ecu.h"
+
+namespace obd2_sim {
+    class simulator {
+        public:
+            static const std::string DEFAULT_CAN_DEVICE;
+            static const std::string DEFAULT_VEHICLES_DIR;
+            static const uint32_t DEFAULT_SEED;
+            static const uint32_t DEFAULT_STATS_INTERVAL_MS;
+
+            simulator(const std::string &config_path);
+            simulator(const simulator &s) = delete;
+            simulator(simulator &&s) = delete;
+            ~simulator();
+
+            simulator &operator=(const simulator &s) = delete;
+            simulator &operator=(simulator &&s) = delete;
+
+            void run();
+            void stop();
+
+        private:
+            std::string can_device      = DEFAULT_CAN_DEVICE;
+            std::string vehicles_dir    = DEFAULT_VEHICLES_DIR;
+            uint32_t seed               = DEFAULT_SEED;
+            uint32_t stats_interval_ms  = DEFAULT_STATS_INTERVAL_MS;
+
+            ecu_config default_ecu_config;
+            std::unordered_map<uint32_t, ecu_config> ecu_configs;
+            std::unordered_map<uint32_t, std::unique_ptr<virtual_ecu>> ecus;
+            std::unordered_map<uint32_t, uint64_t> last_answered; // ECU ID => Responses at the last stats print
+
+            std::mutex running_mutex;
+            std::condition_variable running_cv;
+            bool running = false;
+
+            void load_config(const std::string &config_path);
+            uint32_t load_vehicles();
+            void add_request(const obd2_server::request &r);
+            void print_stats(std::chrono::milliseconds elapsed);
+    };
+
+    void from_json(const nlohmann::json &j, ecu_config &c);
+}
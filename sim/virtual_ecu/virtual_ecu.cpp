@@ -0,0 +1,358 @@
+#include "virtual_ecu.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <linux/can.h>
+#include <linux/can/isotp.h>
+#include <net/if.h>
+#include <poll.h>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <system_error>
+#include <unistd.h>
+
+namespace obd2_sim {
+    virtual_ecu::virtual_ecu(uint32_t id, const ecu_config &config, uint32_t seed) 
+        : id(id), config(config), rng(seed ^ id), dtcs(config.dtcs) { }
+
+    virtual_ecu::~virtual_ecu() {
+        stop();
+    }
+
+    void virtual_ecu::add_pid(uint8_t service, uint16_t pid, size_t length) {
+        auto it = pids.find({ service, pid });
+
+        // Several requests can decode the same PID, answer with the longest layout
+        if (it != pids.end()) {
+            it->second.length = std::max(it->second.length, length);
+            return;
+        }
+
+        std::uniform_real_distribution<double> period(5, 30);
+        std::uniform_real_distribution<double> phase(0, 2 * M_PI);
+
+        pids[{ service, pid }] = signal{ length, period(rng), phase(rng) };
+    }
+
+    void virtual_ecu::start(const std::string &device) {
+        if (running) {
+            return;
+        }
+
+        physical_fd = open_socket(device, id, id + RESPONSE_OFFSET);
+        functional_fd = open_socket(device, FUNCTIONAL_ID, id + RESPONSE_OFFSET);
+        start_time = std::chrono::steady_clock::now();
+
+        running = true;
+        ecu_thread = std::thread(&virtual_ecu::ecu_loop, this);
+    }
+
+    void virtual_ecu::stop() {
+        if (!running) {
+            return;
+        }
+
+        running = false;
+        ecu_thread.join();
+
+        close(physical_fd);
+        close(functional_fd);
+        physical_fd = -1;
+        functional_fd = -1;
+    }
+
+    uint32_t virtual_ecu::get_id() const {
+        return id;
+    }
+
+    size_t virtual_ecu::get_pid_count() const {
+        return pids.size();
+    }
+
+    uint64_t virtual_ecu::get_received() const {
+        return received;
+    }
+
+    uint64_t virtual_ecu::get_answered() const {
+        return answered;
+    }
+
+    uint64_t virtual_ecu::get_dropped() const {
+        return dropped;
+    }
+
+    void virtual_ecu::ecu_loop() {
+        pollfd pfds[2] = {
+            { physical_fd, POLLIN, 0 },
+            { functional_fd, POLLIN, 0 }
+        };
+        std::vector<uint8_t> buffer(MAX_MESSAGE_SIZE);
+
+        while (running) {
+            // Wake up regularly to check if the simulator is stopping
+            if (poll(pfds, 2, 100) <= 0) {
+                continue;
+            }
+
+            for (size_t i = 0; i < 2; i++) {
+                if (!(pfds[i].revents & POLLIN)) {
+                    continue;
+                }
+
+                ssize_t len = read(pfds[i].fd, buffer.data(), buffer.size());
+
+                if (len <= 0) {
+                    continue;
+                }
+
+                handle_message(std::vector<uint8_t>(buffer.begin(), buffer.begin() + len), i == 1);
+            }
+        }
+    }
+
+    void virtual_ecu::handle_message(const std::vector<uint8_t> &message, bool functional) {
+        std::vector<uint8_t> response;
+
+        received++;
+
+        switch (message[0]) {
+            case 0x01:
+                response = handle_service_01(message, functional);
+                break;
+            case 0x03:
+                response = handle_service_03();
+                break;
+            case 0x04:
+                response = handle_service_04();
+                break;
+            case 0x09:
+                response = handle_service_09(message);
+                break;
+            case 0x21:
+            case 0x22:
+                response = handle_read_data(message);
+                break;
+            default:
+                response = functional ? std::vector<uint8_t>() : negative_response(message[0], 0x11);
+                break;
+        }
+
+        // Functional requests for data this ECU does not have stay unanswered
+        if (response.empty()) {
+            return;
+        }
+
+        std::uniform_real_distribution<double> chance(0, 1);
+
+        if (chance(rng) < config.drop_rate) {
+            dropped++;
+            return;
+        }
+
+        uint32_t delay = config.latency_ms;
+
+        if (config.jitter_ms > 0) {
+            std::uniform_int_distribution<uint32_t> jitter(0, config.jitter_ms);
+            delay += jitter(rng);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+
+        // Always answer on the physical socket, the tester sends flow control to the ECU's own ID
+        if (write(physical_fd, response.data(), response.size()) == static_cast<ssize_t>(response.size())) {
+            answered++;
+        }
+    }
+
+    std::vector<uint8_t> virtual_ecu::handle_service_01(const std::vector<uint8_t> &message, bool functional) {
+        std::vector<uint8_t> response = { 0x41 };
+
+        // Up to six PIDs per request, only the supported ones are answered
+        for (size_t i = 1; i < message.size() && i <= 6; i++) {
+            uint8_t pid = message[i];
+
+            if (pid % 0x20 == 0) {
+                response.push_back(pid);
+                append_support_bitmap(0x01, pid, response);
+                continue;
+            }
+
+            append_pid_data(0x01, pid, response);
+        }
+
+        if (response.size() > 1) {
+            return response;
+        }
+
+        return functional ? std::vector<uint8_t>() : negative_response(0x01, 0x12);
+    }
+
+    std::vector<uint8_t> virtual_ecu::handle_service_03() {
+        std::lock_guard<std::mutex> dtcs_lock(dtcs_mutex);
+        std::vector<uint8_t> response = { 0x43, static_cast<uint8_t>(dtcs.size()) };
+
+        // Encode e.g. "P0301" as two bytes, the letter selects the upper two bits.
+        // Codes are validated when the config is loaded
+        for (const auto &code : dtcs) {
+            static const std::string systems = "PCBU";
+
+            uint16_t value = (systems.find(code[0]) & 0x3) << 14;
+            value |= std::stoul(code.substr(1), nullptr, 16) & 0x3FFF;
+
+            response.push_back(value >> 8);
+            response.push_back(value & 0xFF);
+        }
+
+        return response;
+    }
+
+    std::vector<uint8_t> virtual_ecu::handle_service_04() {
+        std::lock_guard<std::mutex> dtcs_lock(dtcs_mutex);
+
+        dtcs.clear();
+
+        return { 0x44 };
+    }
+
+    std::vector<uint8_t> virtual_ecu::handle_service_09(const std::vector<uint8_t> &message) {
+        if (message.size() < 2) {
+            return negative_response(0x09, 0x13);
+        }
+
+        std::vector<uint8_t> response = { 0x49, message[1] };
+
+        switch (message[1]) {
+            case 0x00:
+                // Supported: VIN (0x02) and ECU name (0x0A)
+                response.insert(response.end(), { 0x40, 0x40, 0x00, 0x00 });
+                break;
+            case 0x02:
+                response.push_back(0x01);
+                response.insert(response.end(), config.vin.begin(), config.vin.end());
+                break;
+            case 0x0A: {
+                std::string name = config.name;
+
+                name.resize(20, '\0');
+                response.push_back(0x01);
+                response.insert(response.end(), name.begin(), name.end());
+                break;
+            }
+            default:
+                return negative_response(0x09, 0x12);
+        }
+
+        return response;
+    }
+
+    std::vector<uint8_t> virtual_ecu::handle_read_data(const std::vector<uint8_t> &message) {
+        uint8_t service = message[0];
+
+        // 0x21 reads a one byte local identifier, 0x22 a two byte data identifier
+        size_t id_length = service == 0x21 ? 1 : 2;
+
+        if (message.size() < 1 + id_length) {
+            return negative_response(service, 0x13);
+        }
+
+        uint16_t pid = service == 0x21 ? message[1] : (message[1] << 8) | message[2];
+        std::vector<uint8_t> response(message.begin(), message.begin() + 1 + id_length);
+
+        response[0] = service + 0x40;
+
+        if (!append_pid_data(service, pid, response)) {
+            return negative_response(service, 0x31);
+        }
+
+        return response;
+    }
+
+    bool virtual_ecu::append_pid_data(uint8_t service, uint16_t pid, std::vector<uint8_t> &out) {
+        auto it = pids.find({ service, pid });
+
+        if (it == pids.end()) {
+            return false;
+        }
+
+        const signal &s = it->second;
+        double t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+        // Service 01 repeats the PID in front of its data, 0x21/0x22 already echo the identifier
+        if (service == 0x01) {
+            out.push_back(pid);
+        }
+
+        // Every byte follows a sine wave, later bytes a little faster than the first
+        for (size_t i = 0; i < s.length; i++) {
+            double value = std::sin(2 * M_PI * t * (i + 1) / s.period_s + s.phase);
+            out.push_back(static_cast<uint8_t>(127.5 + 127.5 * value));
+        }
+
+        return true;
+    }
+
+    void virtual_ecu::append_support_bitmap(uint8_t service, uint16_t base, std::vector<uint8_t> &out) const {
+        uint32_t bitmap = 0;
+
+        for (uint16_t i = 1; i < 0x20; i++) {
+            if (pid_supported(service, base + i)) {
+                bitmap |= 1u << (0x20 - i);
+            }
+        }
+
+        // The last bit announces the next bitmap, if any higher PID is supported
+        auto next = pids.upper_bound({ service, base + 0x20 });
+
+        if (next != pids.end() && next->first.first == service) {
+            bitmap |= 1;
+        }
+
+        out.push_back(bitmap >> 24);
+        out.push_back((bitmap >> 16) & 0xFF);
+        out.push_back((bitmap >> 8) & 0xFF);
+        out.push_back(bitmap & 0xFF);
+    }
+
+    bool virtual_ecu::pid_supported(uint8_t service, uint16_t pid) const {
+        return pids.find({ service, pid }) != pids.end();
+    }
+
+    std::vector<uint8_t> virtual_ecu::negative_response(uint8_t service, uint8_t code) const {
+        return { 0x7F, service, code };
+    }
+
+    int virtual_ecu::open_socket(const std::string &device, uint32_t rx_id, uint32_t tx_id) {
+        int fd = socket(PF_CAN, SOCK_DGRAM | SOCK_CLOEXEC, CAN_ISOTP);
+
+        if (fd < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()), "Could not open ISO-TP socket");
+        }
+
+        can_isotp_options opts = { };
+        can_isotp_fc_options fc_opts = { };
+        sockaddr_can addr = { };
+
+        // Pad frames to 8 bytes like real ECUs do
+        opts.flags = CAN_ISOTP_TX_PADDING;
+        opts.txpad_content = 0xAA;
+        fc_opts.bs = config.block_size;
+        fc_opts.stmin = config.st_min;
+
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = if_nametoindex(device.c_str());
+        addr.can_addr.tp.rx_id = rx_id;
+        addr.can_addr.tp.tx_id = tx_id;
+
+        if (addr.can_ifindex == 0
+            || setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_OPTS, &opts, sizeof(opts)) < 0
+            || setsockopt(fd, SOL_CAN_ISOTP, CAN_ISOTP_RECV_FC, &fc_opts, sizeof(fc_opts)) < 0
+            || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            int err = errno;
+            close(fd);
+            throw std::system_error(std::error_code(err, std::generic_category()), "Could not bind ISO-TP socket on " + device);
+        }
+
+        return fd;
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace obd2_sim {
+    struct ecu_config {
+        uint32_t latency_ms = 5;
+        uint32_t jitter_ms = 0;
+        double drop_rate = 0;
+
+        // ISO-TP flow control sent to the tester for multi-frame requests
+        uint8_t block_size = 0;
+        uint8_t st_min = 0;
+
+        std::string vin = "WDD0000000SIM0001";
+        std::string name = "";
+        std::vector<std::string> dtcs;
+    };
+
+    class virtual_ecu {
+        public:
+            virtual_ecu(uint32_t id, const ecu_config &config, uint32_t seed);
+            virtual_ecu(const virtual_ecu &e) = delete;
+            virtual_ecu(virtual_ecu &&e) = delete;
+            ~virtual_ecu();
+
+            virtual_ecu &operator=(const virtual_ecu &e) = delete;
+            virtual_ecu &operator=(virtual_ecu &&e) = delete;
+
+            void add_pid(uint8_t service, uint16_t pid, size_t length);
+            void start(const std::string &device);
+            void stop();
+
+            uint32_t get_id() const;
+            size_t get_pid_count() const;
+            uint64_t get_received() const;
+            uint64_t get_answered() const;
+            uint64_t get_dropped() const;
+
+        private:
+            static const uint32_t FUNCTIONAL_ID = 0x7DF;
+            static const uint32_t RESPONSE_OFFSET = 8;
+            static const size_t MAX_MESSAGE_SIZE = 4095;
+
+            // Parameters of the waveform a PID's bytes follow
+            struct signal {
+                size_t length;
+                double period_s;
+                double phase;
+            };
+
+            uint32_t id;
+            ecu_config config;
+            std::mt19937 rng;
+            std::map<std::pair<uint8_t, uint16_t>, signal> pids; // (Service, PID) => Signal
+            std::chrono::steady_clock::time_point start_time;
+
+            std::mutex dtcs_mutex;
+            std::vector<std::string> dtcs;
+
+            int physical_fd = -1;
+            int functional_fd = -1;
+            std::thread ecu_thread;
+            std::atomic<bool> running = false;
+
+            std::atomic<uint64_t> received = 0;
+            std::atomic<uint64_t> answered = 0;
+            std::atomic<uint64_t> dropped = 0;
+
+            void ecu_loop();
+            void handle_message(const std::vector<uint8_t> &message, bool functional);
+            std::vector<uint8_t> handle_service_01(const std::vector<uint8_t> &message, bool functional);
+            std::vector<uint8_t> handle_service_03();
+            std::vector<uint8_t> handle_service_04();
+            std::vector<uint8_t> handle_service_09(const std::vector<uint8_t> &message);
+            std::vector<uint8_t> handle_read_data(const std::vector<uint8_t> &message);
+
+            bool append_pid_data(uint8_t service, uint16_t pid, std::vector<uint8_t> &out);
+            void append_support_bitmap(uint8_t service, uint16_t base, std::vector<uint8_t> &out) const;
+            bool pid_supported(uint8_t service, uint16_t pid) const;
+            std::vector<uint8_t> negative_response(uint8_t service, uint8_t code) const;
+
+            int open_socket(const std::string &device, uint32_t rx_id, uint32_t tx_id);
+    };
+}
@@ -0,0 +1,432 @@
+#include "compression.h"
+
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <system_error>
+#include <vector>
+
+#ifdef OBD2_SERVER_ZLIB_SUPPORT
+#include <zlib.h>
+#endif
+
+#ifdef OBD2_SERVER_BROTLI_SUPPORT
+#include <brotli/decode.h>
+#include <brotli/encode.h>
+#endif
+
+namespace obd2_server {
+    namespace {
+        using chunk_callback = std::function<bool(const char *data, size_t size)>;
+
+        const size_t FILE_CHUNK_SIZE = 64 * 1024;
+        const size_t OUTPUT_CHUNK_SIZE = 16 * 1024;
+
+        // The encoder default (11) takes seconds per megabyte on a Pi, 5 is within a few percent of its size
+        const int BROTLI_QUALITY = 5;
+
+        class compressor {
+            public:
+                virtual ~compressor() = default;
+
+                // Call with last set once, possibly without data, to finish the stream
+                virtual bool compress(const char *data, size_t size, bool last, const chunk_callback &callback) = 0;
+        };
+
+        class decompressor {
+            public:
+                virtual ~decompressor() = default;
+
+                virtual bool decompress(const char *data, size_t size, const chunk_callback &callback) = 0;
+        };
+
+#ifdef OBD2_SERVER_ZLIB_SUPPORT
+        class gzip_compressor : public compressor {
+            public:
+                gzip_compressor() {
+                    // 15 window bits + 16 for a gzip header and trailer
+                    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+                        throw std::runtime_error("Could not initialize gzip compressor");
+                    }
+                }
+
+                ~gzip_compressor() {
+                    deflateEnd(&stream);
+                }
+
+                bool compress(const char *data, size_t size, bool last, const chunk_callback &callback) override {
+                    char out[OUTPUT_CHUNK_SIZE];
+                    int flush = last ? Z_FINISH : Z_NO_FLUSH;
+
+                    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+                    stream.avail_in = size;
+
+                    do {
+                        stream.next_out = reinterpret_cast<Bytef *>(out);
+                        stream.avail_out = sizeof(out);
+
+                        if (deflate(&stream, flush) == Z_STREAM_ERROR) {
+                            return false;
+                        }
+
+                        size_t produced = sizeof(out) - stream.avail_out;
+
+                        if (produced > 0 && !callback(out, produced)) {
+                            return false;
+                        }
+                    } while (stream.avail_out == 0);
+
+                    return stream.avail_in == 0;
+                }
+
+            private:
+                z_stream stream = { };
+        };
+
+        class gzip_decompressor : public decompressor {
+            public:
+                gzip_decompressor() {
+                    // 15 window bits + 32 to accept both gzip and zlib headers
+                    if (inflateInit2(&stream, 15 + 32) != Z_OK) {
+                        throw std::runtime_error("Could not initialize gzip decompressor");
+                    }
+                }
+
+                ~gzip_decompressor() {
+                    inflateEnd(&stream);
+                }
+
+                bool decompress(const char *data, size_t size, const chunk_callback &callback) override {
+                    char out[OUTPUT_CHUNK_SIZE];
+
+                    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data));
+                    stream.avail_in = size;
+
+                    while (stream.avail_in > 0) {
+                        stream.next_out = reinterpret_cast<Bytef *>(out);
+                        stream.avail_out = sizeof(out);
+
+                        int result = inflate(&stream, Z_NO_FLUSH);
+
+                        if (result != Z_OK && result != Z_STREAM_END && result != Z_BUF_ERROR) {
+                            return false;
+                        }
+
+                        size_t produced = sizeof(out) - stream.avail_out;
+
+                        if (produced > 0 && !callback(out, produced)) {
+                            return false;
+                        }
+
+                        // Concatenated gzip members are one stream
+                        if (result == Z_STREAM_END) {
+                            inflateReset(&stream);
+                        }
+                        else if (result == Z_BUF_ERROR && produced == 0) {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+
+            private:
+                z_stream stream = { };
+        };
+#endif
+
+#ifdef OBD2_SERVER_BROTLI_SUPPORT
+        class brotli_compressor : public compressor {
+            public:
+                brotli_compressor() {
+                    state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+
+                    if (state == nullptr) {
+                        throw std::runtime_error("Could not initialize brotli compressor");
+                    }
+
+                    BrotliEncoderSetParameter(state, BROTLI_PARAM_QUALITY, BROTLI_QUALITY);
+                }
+
+                ~brotli_compressor() {
+                    BrotliEncoderDestroyInstance(state);
+                }
+
+                bool compress(const char *data, size_t size, bool last, const chunk_callback &callback) override {
+                    uint8_t out[OUTPUT_CHUNK_SIZE];
+                    const uint8_t *next_in = reinterpret_cast<const uint8_t *>(data);
+                    size_t available_in = size;
+                    BrotliEncoderOperation operation = last ? BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS;
+
+                    while (true) {
+                        uint8_t *next_out = out;
+                        size_t available_out = sizeof(out);
+
+                        if (!BrotliEncoderCompressStream(state, operation, &available_in, &next_in, 
+                            &available_out, &next_out, nullptr)) {
+                            return false;
+                        }
+
+                        size_t produced = sizeof(out) - available_out;
+
+                        if (produced > 0 && !callback(reinterpret_cast<const char *>(out), produced)) {
+                            return false;
+                        }
+
+                        bool done = last 
+                            ? BrotliEncoderIsFinished(state) 
+                            : available_in == 0 && !BrotliEncoderHasMoreOutput(state);
+
+                        if (done) {
+                            return true;
+                        }
+                    }
+                }
+
+            private:
+                BrotliEncoderState *state;
+        };
+
+        class brotli_decompressor : public decompressor {
+            public:
+                brotli_decompressor() {
+                    state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+
+                    if (state == nullptr) {
+                        throw std::runtime_error("Could not initialize brotli decompressor");
+                    }
+                }
+
+                ~brotli_decompressor() {
+                    BrotliDecoderDestroyInstance(state);
+                }
+
+                bool decompress(const char *data, size_t size, const chunk_callback &callback) override {
+                    uint8_t out[OUTPUT_CHUNK_SIZE];
+                    const uint8_t *next_in = reinterpret_cast<const uint8_t *>(data);
+                    size_t available_in = size;
+                    BrotliDecoderResult result = BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT;
+
+                    while (result == BROTLI_DECODER_RESULT_NEEDS_MORE_OUTPUT) {
+                        uint8_t *next_out = out;
+                        size_t available_out = sizeof(out);
+
+                        result = BrotliDecoderDecompressStream(state, &available_in, &next_in, 
+                            &available_out, &next_out, nullptr);
+
+                        if (result == BROTLI_DECODER_RESULT_ERROR) {
+                            return false;
+                        }
+
+                        size_t produced = sizeof(out) - available_out;
+
+                        if (produced > 0 && !callback(reinterpret_cast<const char *>(out), produced)) {
+                            return false;
+                        }
+                    }
+
+                    return true;
+                }
+
+            private:
+                BrotliDecoderState *state;
+        };
+#endif
+
+        std::unique_ptr<compressor> create_compressor(content_encoding encoding) {
+#ifdef OBD2_SERVER_ZLIB_SUPPORT
+            if (encoding == content_encoding::GZIP) {
+                return std::make_unique<gzip_compressor>();
+            }
+#endif
+
+#ifdef OBD2_SERVER_BROTLI_SUPPORT
+            if (encoding == content_encoding::BROTLI) {
+                return std::make_unique<brotli_compressor>();
+            }
+#endif
+
+            throw std::invalid_argument("Unsupported content encoding");
+        }
+
+        std::unique_ptr<decompressor> create_decompressor(content_encoding encoding) {
+#ifdef OBD2_SERVER_ZLIB_SUPPORT
+            if (encoding == content_encoding::GZIP) {
+                return std::make_unique<gzip_decompressor>();
+            }
+#endif
+
+#ifdef OBD2_SERVER_BROTLI_SUPPORT
+            if (encoding == content_encoding::BROTLI) {
+                return std::make_unique<brotli_decompressor>();
+            }
+#endif
+
+            throw std::invalid_argument("Unsupported content encoding");
+        }
+    }
+
+    content_encoding select_content_encoding(const std::string &accept_encoding) {
+        // Brotli is smaller, gzip is understood everywhere
+#ifdef OBD2_SERVER_BROTLI_SUPPORT
+        if (accept_encoding.find("br") != std::string::npos) {
+            return content_encoding::BROTLI;
+        }
+#endif
+
+#ifdef OBD2_SERVER_ZLIB_SUPPORT
+        if (accept_encoding.find("gzip") != std::string::npos) {
+            return content_encoding::GZIP;
+        }
+#endif
+
+        return content_encoding::NONE;
+    }
+
+    bool content_encoding_supported(content_encoding encoding) {
+        switch (encoding) {
+#ifdef OBD2_SERVER_ZLIB_SUPPORT
+            case content_encoding::GZIP:
+                return true;
+#endif
+#ifdef OBD2_SERVER_BROTLI_SUPPORT
+            case content_encoding::BROTLI:
+                return true;
+#endif
+            default:
+                return false;
+        }
+    }
+
+    std::string get_content_encoding_name(content_encoding encoding) {
+        switch (encoding) {
+            case content_encoding::GZIP:
+                return "gzip";
+            case content_encoding::BROTLI:
+                return "br";
+            default:
+                return "";
+        }
+    }
+
+    std::string compress(const std::string &data, content_encoding encoding) {
+        std::unique_ptr<compressor> compressor = create_compressor(encoding);
+        std::string compressed;
+
+        bool success = compressor->compress(data.data(), data.size(), true, [&compressed](const char *chunk, size_t length) {
+            compressed.append(chunk, length);
+            return true;
+        });
+
+        if (!success) {
+            throw std::runtime_error("Could not compress response");
+        }
+
+        return compressed;
+    }
+
+    std::string get_file_extension(content_encoding encoding) {
+        switch (encoding) {
+            case content_encoding::GZIP:
+                return ".gz";
+            case content_encoding::BROTLI:
+                return ".br";
+            default:
+                return "";
+        }
+    }
+
+    void compress_file(const std::string &path, const std::string &compressed_path, content_encoding encoding) {
+        std::unique_ptr<compressor> compressor = create_compressor(encoding);
+        std::ifstream in(path, std::ios::binary);
+        std::ofstream out(compressed_path, std::ios::binary | std::ios::trunc);
+
+        if (!in.is_open() || !out.is_open()) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        std::vector<char> chunk(FILE_CHUNK_SIZE);
+
+        // The last call is made on the empty read at the end of the file, which finishes the stream
+        while (true) {
+            in.read(chunk.data(), chunk.size());
+            size_t length = in.gcount();
+            bool last = length == 0;
+
+            bool success = compressor->compress(chunk.data(), length, last, [&out](const char *data, size_t size) {
+                out.write(data, size);
+                return out.good();
+            });
+
+            if (!success || in.bad()) {
+                throw std::runtime_error("Could not compress " + path);
+            }
+
+            if (last) {
+                break;
+            }
+        }
+
+        out.close();
+
+        if (!out.good()) {
+            throw std::runtime_error("Could not write " + compressed_path);
+        }
+    }
+
+    bool decompress_file(const std::string &path, content_encoding encoding, 
+        const std::function<bool(const char *data, size_t size)> &sink) {
+        std::unique_ptr<decompressor> decompressor = create_decompressor(encoding);
+        std::ifstream in(path, std::ios::binary);
+
+        if (!in.is_open()) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        std::vector<char> chunk(FILE_CHUNK_SIZE);
+        bool stopped = false;
+
+        while (in.read(chunk.data(), chunk.size()) || in.gcount() > 0) {
+            bool success = decompressor->decompress(chunk.data(), in.gcount(), [&](const char *data, size_t size) {
+                stopped = !sink(data, size);
+                return !stopped;
+            });
+
+            if (stopped) {
+                return false;
+            }
+
+            if (!success) {
+                throw std::runtime_error("Could not decompress " + path);
+            }
+        }
+
+        if (in.bad()) {
+            throw std::runtime_error("Could not read " + path);
+        }
+
+        return true;
+    }
+
+    size_t get_decompressed_size(const std::string &path, content_encoding encoding) {
+        if (encoding != content_encoding::GZIP) {
+            throw std::invalid_argument("Size not stored by content encoding");
+        }
+
+        std::ifstream in(path, std::ios::binary);
+
+        if (!in.is_open()) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        // The gzip trailer ends with the size of the input modulo 2^32, little-endian
+        uint8_t trailer[4];
+
+        if (!in.seekg(-static_cast<std::streamoff>(sizeof(trailer)), std::ios::end) 
+            || !in.read(reinterpret_cast<char *>(trailer), sizeof(trailer))) {
+            throw std::runtime_error("Not a gzip file: " + path);
+        }
+
+        return trailer[0] | (trailer[1] << 8) | (trailer[2] << 16) | (static_cast<uint32_t>(trailer[3]) << 24);
+    }
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <functional>
+#include <string>
+
+namespace obd2_server {
+    // Content encodings the server can produce, depending on the compression libraries it was built with
+    enum class content_encoding {
+        NONE,
+        GZIP,
+        BROTLI
+    };
+
+    content_encoding select_content_encoding(const std::string &accept_encoding);
+    bool content_encoding_supported(content_encoding encoding);
+    std::string get_content_encoding_name(content_encoding encoding);
+    std::string compress(const std::string &data, content_encoding encoding);
+
+    // Files are processed in chunks, so neither side is ever held in memory as a whole
+    std::string get_file_extension(content_encoding encoding); // With the dot
+    void compress_file(const std::string &path, const std::string &compressed_path, content_encoding encoding);
+    bool decompress_file(const std::string &path, content_encoding encoding, // False if sink returned false
+        const std::function<bool(const char *data, size_t size)> &sink);
+    size_t get_decompressed_size(const std::string &path, content_encoding encoding); // Without decompressing, gzip only
+}
@@ -0,0 +1,394 @@
+#include "binary_logger.h"
+
+#include <algorithm>
+#include <bit>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <system_error>
+#include <unistd.h>
+
+#include "../csv_logger/csv_logger.h"
+
+namespace obd2_server {
+    // Fields are copied as they are in memory
+    static_assert(std::endian::native == std::endian::little, "Binary logs require a little-endian host");
+
+    const char binary_logger::MAGIC[8] = { 'O', 'B', 'D', '2', 'L', 'O', 'G', '\0' };
+    const uint32_t binary_logger::VERSION = 1;
+    const uint32_t binary_logger::FLAG_RAW = 1;
+
+    // Everything the value table keeps, so multi-frame responses are logged whole
+    const uint32_t binary_logger::RAW_WIDTH = value_table::MAX_RAW_SIZE;
+
+    namespace {
+        template <typename T>
+        void put(std::string &out, T value) {
+            out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        }
+
+        template <typename T>
+        T get(const uint8_t *&in) {
+            T value;
+            std::memcpy(&value, in, sizeof(value));
+            in += sizeof(value);
+            return value;
+        }
+
+        int64_t to_ms(std::chrono::system_clock::time_point time) {
+            return std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+        }
+    }
+
+    binary_logger::binary_logger() { }
+
+    binary_logger::binary_logger(const std::vector<std::string> &header, const std::string &filename, bool use_bytes, 
+        std::chrono::system_clock::time_point start_time) 
+        : file(filename) {
+        uint32_t column_size = use_bytes ? 1 + RAW_WIDTH : sizeof(float) + sizeof(uint32_t);
+        std::string names;
+
+        for (const auto &col : header) {
+            put<uint16_t>(names, col.size());
+            names += col;
+        }
+
+        // Records start 8-byte aligned, so a mapping of the file can be read in place
+        uint32_t header_size = sizeof(MAGIC) + 6 * sizeof(uint32_t) + sizeof(int64_t) + names.size();
+        header_size = (header_size + 7) & ~7u;
+
+        record.append(MAGIC, sizeof(MAGIC));
+        put<uint32_t>(record, VERSION);
+        put<uint32_t>(record, use_bytes ? FLAG_RAW : 0);
+        put<uint32_t>(record, header.size());
+        put<uint32_t>(record, sizeof(int64_t) + header.size() * column_size);
+        put<uint32_t>(record, RAW_WIDTH);
+        put<uint32_t>(record, header_size);
+        put<int64_t>(record, to_ms(start_time));
+        record += names;
+        record.resize(header_size, '\0');
+
+        file.append(record);
+        file.flush();
+    }
+
+    bool binary_logger::write_row(std::chrono::system_clock::time_point time, const std::vector<value_sample> &data) {
+        const int64_t time_ms = to_ms(time);
+
+        record.clear();
+        put<int64_t>(record, time_ms);
+
+        for (const value_sample &d : data) {
+            uint32_t age_ms = std::numeric_limits<uint32_t>::max();
+
+            if (d.timestamp.time_since_epoch().count() != 0) {
+                age_ms = std::min<int64_t>(std::max<int64_t>(time_ms - to_ms(d.timestamp), 0), age_ms - 1);
+            }
+
+            put<float>(record, d.value);
+            put<uint32_t>(record, age_ms);
+        }
+
+        return file.append(record);
+    }
+
+    bool binary_logger::write_row_raw(std::chrono::system_clock::time_point time, const std::vector<std::vector<uint8_t>> &data) {
+        record.clear();
+        put<int64_t>(record, to_ms(time));
+
+        for (const auto &col : data) {
+            size_t size = std::min<size_t>(col.size(), RAW_WIDTH);
+
+            put<uint8_t>(record, size);
+            record.append(reinterpret_cast<const char *>(col.data()), size);
+            record.append(RAW_WIDTH - size, '\0');
+        }
+
+        return file.append(record);
+    }
+
+    void binary_logger::flush(bool sync) {
+        file.flush(sync);
+    }
+
+    bool binary_logger::get_is_active() const {
+        return file.is_open();
+    }
+
+    size_t binary_logger::get_size() const {
+        return file.get_size();
+    }
+
+    binary_log_reader::binary_log_reader(const std::string &filename, content_encoding encoding) : 
+        filename(filename), encoding(encoding) {
+        if (encoding == content_encoding::NONE) {
+            map_file();
+
+            try {
+                parse_header(data, size);
+            }
+            catch (...) {
+                unmap_file();
+                throw;
+            }
+
+            return;
+        }
+
+        // Only the header is decompressed here, the fixed part tells how long it is
+        const size_t fixed_size = sizeof(binary_logger::MAGIC) + 6 * sizeof(uint32_t) + sizeof(int64_t);
+        const size_t header_size_offset = fixed_size - sizeof(uint32_t) - sizeof(int64_t);
+        std::string header;
+        size_t needed = fixed_size;
+
+        decompress_file(filename, encoding, [&](const char *chunk, size_t length) {
+            while (length > 0 && header.size() < needed) {
+                size_t take = std::min(length, needed - header.size());
+
+                header.append(chunk, take);
+                chunk += take;
+                length -= take;
+
+                // Files that are no binary logs stop here, parse_header rejects them
+                if (header.size() == fixed_size && needed == fixed_size 
+                    && std::memcmp(header.data(), binary_logger::MAGIC, sizeof(binary_logger::MAGIC)) == 0) {
+                    uint32_t total;
+                    std::memcpy(&total, header.data() + header_size_offset, sizeof(total));
+                    needed = std::max<size_t>(total, fixed_size);
+                }
+            }
+
+            return header.size() < needed;
+        });
+
+        parse_header(reinterpret_cast<const uint8_t *>(header.data()), header.size());
+    }
+
+    binary_log_reader::~binary_log_reader() {
+        unmap_file();
+    }
+
+    bool binary_log_reader::get_is_raw() const {
+        return flags & binary_logger::FLAG_RAW;
+    }
+
+    const std::vector<std::string> &binary_log_reader::get_columns() const {
+        return columns;
+    }
+
+    bool binary_log_reader::scan_values(const std::vector<size_t> &columns, 
+        const std::function<bool(int64_t time_ms, const std::vector<float> &values)> &visit) const {
+        if (get_is_raw()) {
+            throw std::logic_error("Raw logs have no values");
+        }
+
+        const size_t column_size = sizeof(float) + sizeof(uint32_t);
+        std::vector<float> values(columns.size());
+
+        // Only the selected columns of each record are read, in place
+        return for_each_record([&](const uint8_t *in) {
+            int64_t time_ms = get<int64_t>(in);
+
+            for (size_t c = 0; c < columns.size(); c++) {
+                const uint8_t *col = in + columns[c] * column_size;
+                float value = get<float>(col);
+                uint32_t age_ms = get<uint32_t>(col);
+
+                values[c] = age_ms == std::numeric_limits<uint32_t>::max() ? std::numeric_limits<float>::quiet_NaN() : value;
+            }
+
+            return visit(time_ms, values);
+        });
+    }
+
+    void binary_log_reader::format_csv_header(std::string &out) const {
+        csv_logger::format_header(out, columns, get_is_raw());
+    }
+
+    bool binary_log_reader::format_csv_rows(std::string &out, size_t chunk_records, 
+        const std::function<bool(std::string &out)> &flush) const {
+        std::vector<value_sample> row(columns.size());
+        std::vector<std::vector<uint8_t>> raw_row(columns.size());
+        size_t pending = 0;
+
+        bool completed = for_each_record([&](const uint8_t *in) {
+            int64_t time_ms = get<int64_t>(in);
+            std::chrono::system_clock::time_point time{std::chrono::milliseconds(time_ms)};
+
+            if (get_is_raw()) {
+                for (auto &col : raw_row) {
+                    uint8_t col_size = std::min<uint32_t>(get<uint8_t>(in), raw_width);
+                    col.assign(in, in + col_size);
+                    in += raw_width;
+                }
+
+                csv_logger::format_row_raw(out, time_ms - start_time, raw_row);
+            }
+            else {
+                for (auto &col : row) {
+                    col.value = get<float>(in);
+                    uint32_t age_ms = get<uint32_t>(in);
+
+                    col.timestamp = age_ms == std::numeric_limits<uint32_t>::max() 
+                        ? std::chrono::system_clock::time_point() 
+                        : time - std::chrono::milliseconds(age_ms);
+                    col.stale = false;
+                }
+
+                csv_logger::format_row(out, time, row);
+            }
+
+            if (++pending < chunk_records) {
+                return true;
+            }
+
+            pending = 0;
+            return flush(out);
+        });
+
+        return completed && flush(out);
+    }
+
+    std::string binary_log_reader::get_csv_string() const {
+        std::string out;
+
+        format_csv_header(out);
+        format_csv_rows(out, std::numeric_limits<size_t>::max(), [](std::string &) { return true; });
+
+        return out;
+    }
+
+    void binary_log_reader::parse_header(const uint8_t *in, size_t available) {
+        const size_t fixed_size = sizeof(binary_logger::MAGIC) + 6 * sizeof(uint32_t) + sizeof(int64_t);
+
+        if (available < fixed_size || std::memcmp(in, binary_logger::MAGIC, sizeof(binary_logger::MAGIC)) != 0) {
+            throw std::runtime_error("Not a binary log: " + filename);
+        }
+
+        const uint8_t *end = in + available;
+        in += sizeof(binary_logger::MAGIC);
+
+        uint32_t version = get<uint32_t>(in);
+        flags = get<uint32_t>(in);
+        uint32_t column_count = get<uint32_t>(in);
+        record_size = get<uint32_t>(in);
+        raw_width = get<uint32_t>(in);
+        header_size = get<uint32_t>(in);
+        start_time = get<int64_t>(in);
+
+        for (uint32_t i = 0; i < column_count && version == binary_logger::VERSION; i++) {
+            if (end - in < static_cast<ptrdiff_t>(sizeof(uint16_t))) {
+                break;
+            }
+
+            uint16_t length = get<uint16_t>(in);
+
+            if (end - in < length) {
+                break;
+            }
+
+            columns.emplace_back(reinterpret_cast<const char *>(in), length);
+            in += length;
+        }
+
+        size_t column_size = (flags & binary_logger::FLAG_RAW) ? 1 + raw_width : sizeof(float) + sizeof(uint32_t);
+
+        if (version != binary_logger::VERSION || columns.size() != column_count || header_size > available 
+            || record_size != sizeof(int64_t) + column_count * column_size) {
+            throw std::runtime_error("Unsupported binary log: " + filename);
+        }
+    }
+
+    bool binary_log_reader::for_each_record(const std::function<bool(const uint8_t *record)> &visit) const {
+        if (encoding == content_encoding::NONE) {
+            const size_t record_count = (size - header_size) / record_size;
+
+            for (size_t r = 0; r < record_count; r++) {
+                if (!visit(data + header_size + r * record_size)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        // Records are passed in place from the decompressed chunks, 
+        // only those split across two chunks are assembled first
+        std::string partial;
+        size_t skip = header_size;
+
+        return decompress_file(filename, encoding, [&](const char *chunk, size_t length) {
+            size_t offset = std::min(skip, length);
+            skip -= offset;
+
+            if (!partial.empty()) {
+                size_t missing = std::min(record_size - partial.size(), length - offset);
+                partial.append(chunk + offset, missing);
+                offset += missing;
+
+                if (partial.size() < record_size) {
+                    return true;
+                }
+
+                if (!visit(reinterpret_cast<const uint8_t *>(partial.data()))) {
+                    return false;
+                }
+
+                partial.clear();
+            }
+
+            for (; length - offset >= record_size; offset += record_size) {
+                if (!visit(reinterpret_cast<const uint8_t *>(chunk + offset))) {
+                    return false;
+                }
+            }
+
+            partial.append(chunk + offset, length - offset);
+            return true;
+        });
+    }
+
+    void binary_log_reader::map_file() {
+        int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            int error = errno;
+
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            throw std::system_error(std::error_code(error, std::generic_category()));
+        }
+
+        size = st.st_size;
+
+        if (size > 0) {
+            void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+
+            if (map == MAP_FAILED) {
+                int error = errno;
+                close(fd);
+                throw std::system_error(std::error_code(error, std::generic_category()));
+            }
+
+            data = static_cast<const uint8_t *>(map);
+            madvise(map, size, MADV_SEQUENTIAL);
+        }
+
+        close(fd);
+    }
+
+    void binary_log_reader::unmap_file() {
+        if (data) {
+            munmap(const_cast<uint8_t *>(data), size);
+        }
+
+        data = nullptr;
+    }
+}
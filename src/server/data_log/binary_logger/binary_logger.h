@@ -0,0 +1,91 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "../buffered_file/buffered_file.h"
+#include "../../compression/compression.h"
+#include "../../obd2_bridge/value_table/value_table.h"
+
+namespace obd2_server {
+    // Fixed-record log file, all fields little-endian:
+    //
+    // Header:  magic "OBD2LOG\0", version (uint32), flags (uint32, bit 0 = raw), column count (uint32), 
+    //          record size (uint32), raw column width (uint32), offset of the first record (uint32), 
+    //          start time in ms since the Unix epoch (int64), then per column: name length (uint16), name
+    // Records: sample time in ms since the Unix epoch (int64), then per column either 
+    //          value (float32) and age in ms (uint32, UINT32_MAX = never received), 
+    //          or raw size (uint8) and raw width bytes. Readers take the width from the header
+    class binary_logger {
+        public:
+            static const char MAGIC[8];
+            static const uint32_t VERSION;
+            static const uint32_t FLAG_RAW;
+            static const uint32_t RAW_WIDTH;
+
+            binary_logger();
+            binary_logger(const std::vector<std::string> &header, const std::string &filename, 
+                bool use_bytes = false, std::chrono::system_clock::time_point start_time = std::chrono::system_clock::now());
+
+            // Same interface as csv_logger
+            bool write_row(std::chrono::system_clock::time_point time, const std::vector<value_sample> &data);
+            bool write_row_raw(std::chrono::system_clock::time_point time, const std::vector<std::vector<uint8_t>> &data);
+            void flush(bool sync = false);
+            bool get_is_active() const;
+            size_t get_size() const;
+
+        private:
+            buffered_file file;
+            std::string record;
+    };
+
+    // Read-only mapping of a binary log. Compressed logs are decompressed as they are read, 
+    // a record at a time, and only up to the header when nothing else is asked for. 
+    // Records that are still being written are left out
+    class binary_log_reader {
+        public:
+            binary_log_reader(const std::string &filename, content_encoding encoding = content_encoding::NONE);
+            binary_log_reader(const binary_log_reader &r) = delete;
+            binary_log_reader(binary_log_reader &&r) = delete;
+            ~binary_log_reader();
+
+            binary_log_reader &operator=(const binary_log_reader &r) = delete;
+            binary_log_reader &operator=(binary_log_reader &&r) = delete;
+
+            bool get_is_raw() const;
+            const std::vector<std::string> &get_columns() const;
+
+            // Values of the given columns for every record of a value log, NaN where the value was never received. 
+            // Stops when visit returns false, which is then returned
+            bool scan_values(const std::vector<size_t> &columns, 
+                const std::function<bool(int64_t time_ms, const std::vector<float> &values)> &visit) const;
+
+            // Append the same CSV a csv_logger would have written. The rows are handed to flush every chunk_records 
+            // records and once at the end, flush may consume out. Stops when flush returns false, which is then returned
+            void format_csv_header(std::string &out) const;
+            bool format_csv_rows(std::string &out, size_t chunk_records, const std::function<bool(std::string &out)> &flush) const;
+            std::string get_csv_string() const;
+
+        private:
+            std::string filename;
+            content_encoding encoding;
+            const uint8_t *data = nullptr; // Mapping of uncompressed logs
+            size_t size = 0;
+
+            uint32_t flags;
+            uint32_t record_size;
+            uint32_t raw_width;
+            uint32_t header_size;
+            int64_t start_time;
+            std::vector<std::string> columns;
+
+            void parse_header(const uint8_t *in, size_t available);
+            bool for_each_record(const std::function<bool(const uint8_t *record)> &visit) const;
+            void map_file();
+            void unmap_file();
+    };
+}
@@ -0,0 +1,106 @@
+#include "buffered_file.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+
+namespace obd2_server {
+    // Far more than the rows of one flush interval, so only a failing disk ever reaches it
+    const size_t buffered_file::MAX_BUFFER_SIZE = 4 * 1024 * 1024;
+
+    buffered_file::buffered_file() { }
+
+    buffered_file::buffered_file(const std::string &filename) {
+        fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+        if (fd < 0) {
+            throw std::runtime_error("Cannot open file " + filename);
+        }
+    }
+
+    buffered_file::buffered_file(buffered_file &&f) noexcept : fd(f.fd), buffer(std::move(f.buffer)), size(f.size) {
+        f.fd = -1;
+    }
+
+    buffered_file::~buffered_file() {
+        close();
+    }
+
+    buffered_file &buffered_file::operator=(buffered_file &&f) noexcept {
+        if (this != &f) {
+            close();
+
+            fd = f.fd;
+            buffer = std::move(f.buffer);
+            size = f.size;
+            f.fd = -1;
+        }
+
+        return *this;
+    }
+
+    bool buffered_file::append(const char *data, size_t size) {
+        if (buffer.size() + size > MAX_BUFFER_SIZE) {
+            return false;
+        }
+
+        buffer.append(data, size);
+        this->size += size;
+
+        return true;
+    }
+
+    bool buffered_file::append(const std::string &data) {
+        return append(data.data(), data.size());
+    }
+
+    void buffered_file::flush(bool sync) {
+        size_t written = 0;
+
+        while (written < buffer.size()) {
+            ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+
+            // Whatever was not written stays buffered for the next attempt
+            if (n < 0) {
+                buffer.erase(0, written);
+                throw std::system_error(std::error_code(errno, std::generic_category()));
+            }
+
+            written += n;
+        }
+
+        buffer.clear();
+
+        if (sync && fdatasync(fd) < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+    }
+
+    bool buffered_file::is_open() const {
+        return fd >= 0;
+    }
+
+    size_t buffered_file::get_size() const {
+        return size;
+    }
+
+    void buffered_file::close() {
+        if (fd < 0) {
+            return;
+        }
+
+        try {
+            flush();
+        }
+        catch (const std::exception &e) { }
+
+        ::close(fd);
+        fd = -1;
+    }
+}
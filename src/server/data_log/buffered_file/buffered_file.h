@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace obd2_server {
+    // Write-only file that collects appended data in memory until it is flushed
+    class buffered_file {
+        public:
+            static const size_t MAX_BUFFER_SIZE;
+
+            buffered_file();
+            buffered_file(const std::string &filename);
+            buffered_file(const buffered_file &f) = delete;
+            buffered_file(buffered_file &&f) noexcept;
+            ~buffered_file();
+
+            buffered_file &operator=(const buffered_file &f) = delete;
+            buffered_file &operator=(buffered_file &&f) noexcept;
+
+            // Data that does not fit into MAX_BUFFER_SIZE, e.g. because flushing keeps failing, is dropped as a whole. 
+            // False if it was dropped
+            bool append(const char *data, size_t size);
+            bool append(const std::string &data);
+            void flush(bool sync = false);
+            bool is_open() const;
+            size_t get_size() const; // Everything appended, flushed or not
+
+        private:
+            int fd = -1;
+            std::string buffer;
+            size_t size = 0;
+
+            void close();
+    };
+}
@@ -1,8 +1,9 @@
 #include "csv_logger.h"
 
+#include <charconv>
 #include <chrono>
-#include <iomanip>
-#include <fstream>
+#include <ctime>
+#include <sstream>
 
 namespace obd2_server {
     csv_logger::csv_logger() {}
@@ -14,87 +15,145 @@ namespace obd2_server {
             use_bytes
         ) {}
 
-    csv_logger::csv_logger(const std::vector<std::string> &header, const std::string &filename, bool use_bytes) 
-        : start_time(std::chrono::system_clock::now()) {
-        file.open(filename);
+    csv_logger::csv_logger(const std::vector<std::string> &header, const std::string &filename, bool use_bytes, 
+        std::chrono::system_clock::time_point start_time) 
+        : file(filename), start_time(start_time) {
+        format_header(row, header, use_bytes);
+        file.append(row);
+        file.flush();
+    }
 
-        if (!file.is_open()) {
-            throw std::runtime_error("Cannot open file " + filename);
-        }
-        
-        write_header(header, use_bytes);
+    bool csv_logger::write_row(std::chrono::system_clock::time_point time, const std::vector<value_sample> &data) {
+        row.clear();
+        format_row(row, time, data);
+        return file.append(row);
     }
 
-    void csv_logger::write_row(const std::vector<float> &data) {
-        uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    bool csv_logger::write_row_raw(std::chrono::system_clock::time_point time, const std::vector<std::vector<uint8_t>> &data) {
+        auto time_since_start = time - start_time;
 
-        file << get_time_string(timestamp);
+        row.clear();
+        format_row_raw(row, std::chrono::duration_cast<std::chrono::milliseconds>(time_since_start).count(), data);
+        return file.append(row);
+    }
 
-        for (float d : data) {
-            file  << ";" << d;
-        }
+    void csv_logger::flush(bool sync) {
+        file.flush(sync);
+    }
 
-        file << std::endl;
+    bool csv_logger::get_is_active() const {
+        return file.is_open();
     }
 
-    void csv_logger::write_row_raw(const std::vector<std::vector<uint8_t>> &data) {
-        auto time_since_start = std::chrono::system_clock::now() - start_time;
-        uint32_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(time_since_start).count();
+    size_t csv_logger::get_size() const {
+        return file.get_size();
+    }
 
-        // Print miliseconds since start as bytes
-        file << std::hex << std::setfill('0') 
-            << std::setw(2) << (timestamp & 0xFF) << " "
-            << std::setw(2) << ((timestamp >> 8) & 0xFF) << " "
-            << std::setw(2) << ((timestamp >> 16) & 0xFF) << " "
-            << std::setw(2) << ((timestamp >> 24) & 0xFF);
+    void csv_logger::format_header(std::string &out, const std::vector<std::string> &header, bool use_bytes) {
+        std::ostringstream file;
 
-        // Print bytes of each col seperated by spaces
-        for (const auto &col : data) {
-            file << ";" << std::hex << std::setfill('0');
+        if (use_bytes) {
+            file << "00:00:00"; // See simulator configuration
+        } else {
+            file << "timestamp";
+        }
 
-            for (size_t i = 0; i < col.size(); i++) {
-                file << std::setw(2) << static_cast<uint16_t>(col[i]);
+        for (const auto &col : header) {
+            file << ";" << col;
 
-                if (i < col.size() - 1) {
-                    file << " ";
-                }
+            if (!use_bytes) {
+                file << ";" << col << " timestamp";
             }
         }
 
-        file << std::endl;
+        file << "\n";
+        out += file.str();
     }
 
-    bool csv_logger::get_is_active() const {
-        return file.is_open();
+    void csv_logger::format_row(std::string &out, std::chrono::system_clock::time_point time, 
+        const std::vector<value_sample> &data) {
+        uint64_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count();
+
+        append_time_string(out, timestamp);
+
+        // Each value is followed by the time it was received, empty if it never was
+        for (const value_sample &d : data) {
+            out += ';';
+            append_float(out, d.value);
+            out += ';';
+
+            if (d.timestamp.time_since_epoch().count() != 0) {
+                append_time_string(out, std::chrono::duration_cast<std::chrono::milliseconds>(d.timestamp.time_since_epoch()).count());
+            }
+        }
+
+        out += '\n';
     }
 
-    void csv_logger::write_header(const std::vector<std::string> &header, bool use_bytes) {
-        const size_t header_count = header.size();
+    void csv_logger::format_row_raw(std::string &out, uint32_t timestamp, 
+        const std::vector<std::vector<uint8_t>> &data) {
+        // Print miliseconds since start as bytes
+        for (uint32_t i = 0; i < sizeof(timestamp); i++) {
+            if (i > 0) {
+                out += ' ';
+            }
 
-        if (use_bytes) {
-            file << "00:00:00"; // See simulator configuration
-        } else {
-            file << "timestamp";
+            append_hex(out, (timestamp >> (8 * i)) & 0xFF);
         }
 
-        for (const auto &col : header) {
-            file << ";" << col;
+        // Print bytes of each col seperated by spaces
+        for (const auto &col : data) {
+            out += ';';
+
+            for (size_t i = 0; i < col.size(); i++) {
+                if (i > 0) {
+                    out += ' ';
+                }
+
+                append_hex(out, col[i]);
+            }
         }
 
-        file << std::endl;
+        out += '\n';
     }
     
-    std::string csv_logger::get_time_string(uint64_t timestamp) const {
-        std::time_t time = timestamp / 1000;
-        std::tm *tm = std::localtime(&time);
+    void csv_logger::append_time_string(std::string &out, uint64_t timestamp) {
+        // Rows of the same second share the prefix, so localtime_r only runs once per second. 
+        // Per thread, rows are formatted by the log writer and by exports at the same time
+        thread_local uint64_t cached_second = UINT64_MAX;
+        thread_local char cached_prefix[9];
+
+        uint64_t second = timestamp / 1000;
+        uint32_t ms = timestamp % 1000;
+
+        if (second != cached_second) {
+            std::time_t time = second;
+            std::tm tm;
+
+            localtime_r(&time, &tm);
+            std::strftime(cached_prefix, sizeof(cached_prefix), "%H:%M:%S", &tm);
+            cached_second = second;
+        }
+
+        const char suffix[4] = { '.', static_cast<char>('0' + ms / 100), static_cast<char>('0' + ms / 10 % 10), 
+            static_cast<char>('0' + ms % 10) };
 
-        char buffer[80];
-        std::strftime(buffer, sizeof(buffer), "%H:%M:%S", tm);
-        std::stringstream time_string;
+        out.append(cached_prefix, 8);
+        out.append(suffix, sizeof(suffix));
+    }
+
+    void csv_logger::append_float(std::string &out, float value) {
+        // Same output as the default formatting of streams (%g), without going through the locale
+        char buffer[32];
+        auto result = std::to_chars(buffer, buffer + sizeof(buffer), value, std::chars_format::general, 6);
 
-        time_string << buffer << "." << std::setw(3) << std::setfill('0') << timestamp % 1000;
+        out.append(buffer, result.ptr);
+    }
 
+    void csv_logger::append_hex(std::string &out, uint8_t byte) {
+        static const char HEX_DIGITS[] = "0123456789abcdef";
 
-        return time_string.str();
+        out += HEX_DIGITS[byte >> 4];
+        out += HEX_DIGITS[byte & 0x0F];
     }
 }
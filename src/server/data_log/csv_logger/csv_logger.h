@@ -1,27 +1,42 @@
 #pragma once
 
 #include <chrono>
-#include <fstream>
 #include <string>
 #include <vector>
 
+#include "../buffered_file/buffered_file.h"
+#include "../../obd2_bridge/value_table/value_table.h"
+
 namespace obd2_server {
     class csv_logger {
         public:
             csv_logger();
             csv_logger(const std::vector<std::string> &header, bool use_bytes = false);
             csv_logger(const std::vector<std::string> &header, const std::string &filename,
-                bool use_bytes = false);
+                bool use_bytes = false, std::chrono::system_clock::time_point start_time = std::chrono::system_clock::now());
 
-            void write_row(const std::vector<float> &data);
-            void write_row_raw(const std::vector<std::vector<uint8_t>> &data);
+            // Rows are buffered until flush(), time is when the row was sampled. False if the row was dropped (see buffered_file)
+            bool write_row(std::chrono::system_clock::time_point time, const std::vector<value_sample> &data);
+            bool write_row_raw(std::chrono::system_clock::time_point time, const std::vector<std::vector<uint8_t>> &data);
+            void flush(bool sync = false);
             bool get_is_active() const;
+            size_t get_size() const;
+
+            // Also used to export binary logs, so both formats produce the same CSV
+            static void format_header(std::string &out, const std::vector<std::string> &header, bool use_bytes);
+            static void format_row(std::string &out, std::chrono::system_clock::time_point time, 
+                const std::vector<value_sample> &data);
+            static void format_row_raw(std::string &out, uint32_t timestamp, // Milliseconds since the log started
+                const std::vector<std::vector<uint8_t>> &data);
             
         private:
-            std::ofstream file;
+            buffered_file file;
+            std::string row;
             std::chrono::time_point<std::chrono::system_clock> start_time;
 
-            void write_header(const std::vector<std::string> &header, bool use_bytes);
-            std::string get_time_string(uint64_t timestamp) const;
+            // Render into the row in place, so formatting a row does not allocate once its buffer has grown
+            static void append_time_string(std::string &out, uint64_t timestamp);
+            static void append_float(std::string &out, float value);
+            static void append_hex(std::string &out, uint8_t byte);
     };
 }
@@ -1,143 +1,710 @@
 #include "data_log.h"
 
+#include <charconv>
+#include <cmath>
+#include <cstring>
 #include <fstream>
 #include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
 
 namespace obd2_server {
+    const size_t data_log::DEFAULT_RING_CAPACITY = 256;
+    const content_encoding data_log::SEGMENT_ENCODING = content_encoding::GZIP;
+    const size_t data_log::EXPORT_CHUNK_SIZE = 64 * 1024;
+    const size_t data_log::EXPORT_CHUNK_RECORDS = 1024;
+
     data_log::data_log() { }
 
-    data_log::data_log(const std::string &name, const std::string &directory) 
-        : name(name), directory(directory) {
-        if (name.find_first_of(RAW_LOG_PREFIX) == 0) {
-            raw_log = true;
+    data_log::data_log(const std::string &name, const std::string &directory, log_format format, uint32_t segment_count) 
+        : name(name), directory(directory), format(format), segment_count(segment_count) {
+        raw_log = name.rfind(RAW_LOG_PREFIX, 0) == 0;
+
+        // The name is the local start time, see generate_name()
+        std::tm tm = {};
+        std::istringstream ss(name.substr(raw_log ? RAW_LOG_PREFIX.size() : 0));
+
+        if (ss >> std::get_time(&tm, "%Y%m%d%H%M%S")) {
+            tm.tm_isdst = -1;
+            start_time = std::chrono::system_clock::from_time_t(std::mktime(&tm));
         }
 
-        file_size = read_file_size();
+        // Binary logs carry the raw flag in their header
+        std::optional<log_segment> first = find_segment(0, false);
+
+        if (format == log_format::BINARY && first) {
+            raw_log = binary_log_reader(first->path, first->encoding).get_is_raw();
+        }
     }
 
     data_log::data_log(const std::unordered_map<UUIDv4::UUID, std::string> &requests, 
-        const std::string &directory, bool raw_log) 
-        : directory(directory), raw_log(raw_log) {
-        std::vector<std::string> header(requests.size());
-        std::string filename;
-        size_t i = 0;
-
+        const std::string &directory, bool raw_log, log_format format, segment_limits limits, size_t ring_capacity) 
+        : directory(directory), raw_log(raw_log), format(format), limits(limits), 
+          start_time(std::chrono::system_clock::now()) {
         for (const auto &req : requests) {
             this->requests.push_back(req.first);
-            header[i] = req.second;
-            col_indices[req.first] = i;
-
-            i++;
+            header.push_back(req.second);
         }
 
         name = generate_name();
 
-        // Use prefix for raw logging
-        filename = directory + "/" + name + ".csv";
-        logger = csv_logger(header, filename, raw_log);
+        open_segment(0);
+
+        ring = std::make_unique<record_ring>(get_record_size(), ring_capacity);
+        is_logging = true;
     }
 
-    void data_log::stop_logging() {
-        if (!logger.get_is_active()) {
-            return;
+    bool data_log::stop_logging() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!is_logging.exchange(false)) {
+            return false;
         }
+
+        // Rows queued before the stop still end up in the file
+        ring->drain([this](const uint8_t *record) { write_record(record); });
         
-        // Clear active logger and update file size
+        // Clear active logger, the last segment is closed like the others
         logger = csv_logger();
-        file_size = read_file_size();
+        closed_segments.push_back(get_segment_path(segment_count - 1));
+
+        return true;
     }
 
-    void data_log::add_data(const std::unordered_map<UUIDv4::UUID, float> &data) {
-        if (!logger.get_is_active()) {
+    std::vector<std::string> data_log::take_closed_segments() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::exchange(closed_segments, {});
+    }
+
+    void data_log::add_data(std::chrono::system_clock::time_point time, 
+        const std::function<value_sample(const UUIDv4::UUID &id)> &get_sample) {
+        if (!is_logging.load(std::memory_order_relaxed)) {
             return;
         }
 
-        std::vector<float> row(requests.size());
+        uint8_t *record = ring->try_reserve();
 
-        for (const auto &d : data) {
-            UUIDv4::UUID req_id = d.first;
-            auto col_it = col_indices.find(req_id);
+        // The writer fell behind, dropping the row keeps the bus cycle on time
+        if (record == nullptr) {
+            overruns++;
+            return;
+        }
 
-            // If the request is not in the log, skip it
-            if (col_it == col_indices.end()) {
-                continue;
-            }
+        int64_t t = time.time_since_epoch().count();
+        std::memcpy(record, &t, sizeof(t));
+        record += sizeof(t);
 
-            row[col_it->second] = d.second;
+        for (const auto &id : requests) {
+            value_sample sample = get_sample(id);
+            std::memcpy(record, &sample, sizeof(sample));
+            record += sizeof(sample);
         }
 
-        logger.write_row(row);
+        ring->commit();
     }
 
-    void data_log::add_data_raw(const std::unordered_map<UUIDv4::UUID, std::vector<uint8_t>> &data) {
-        if (!logger.get_is_active()) {
+    void data_log::add_data_raw(std::chrono::system_clock::time_point time, 
+        const std::function<std::vector<uint8_t>(const UUIDv4::UUID &id)> &get_raw) {
+        if (!is_logging.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        uint8_t *record = ring->try_reserve();
+
+        if (record == nullptr) {
+            overruns++;
             return;
         }
 
-        std::vector<std::vector<uint8_t>> row(requests.size());
+        int64_t t = time.time_since_epoch().count();
+        std::memcpy(record, &t, sizeof(t));
+        record += sizeof(t);
 
-        for (const auto &d : data) {
-            UUIDv4::UUID req_id = d.first;
-            auto col_it = col_indices.find(req_id);
+        // Every column has room for the largest raw value, prefixed with the actual size
+        for (const auto &id : requests) {
+            std::vector<uint8_t> raw = get_raw(id);
+            uint8_t size = std::min(raw.size(), value_table::MAX_RAW_SIZE);
 
-            // If the request is not in the log, skip it
-            if (col_it == col_indices.end()) {
-                continue;
+            record[0] = size;
+            std::memcpy(record + 1, raw.data(), size);
+            record += 1 + value_table::MAX_RAW_SIZE;
+        }
+
+        ring->commit();
+    }
+
+    size_t data_log::write_pending(bool sync) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (!std::visit([](const auto &l) { return l.get_is_active(); }, logger)) {
+            return 0;
+        }
+
+        size_t count = ring->drain([this](const uint8_t *record) { write_record(record); });
+
+        if (count > 0 || sync) {
+            std::visit([sync](auto &l) { l.flush(sync); }, logger);
+        }
+
+        // Checked once per flush, so segments end up slightly larger than max_bytes. 
+        // If the next segment cannot be created (e.g. the disk is full), the current one stays active
+        if (get_segment_full()) {
+            try {
+                open_segment(segment_count);
+            }
+            catch (const std::exception &e) {
+                std::cerr << "Could not open the next segment of log " << name << ": " << e.what() << std::endl;
+                return count;
             }
 
-            row[col_it->second] = d.second;
+            closed_segments.push_back(get_segment_path(segment_count - 1));
+            segment_count++;
         }
 
-        logger.write_row_raw(row);
+        return count;
+    }
+
+    bool data_log::write_csv(const std::function<bool(const char *data, size_t size)> &sink) const {
+        bool header_written = false;
+
+        return for_each_segment([&](const log_segment &segment) {
+            if (!write_segment_csv(segment, !header_written, sink)) {
+                return false;
+            }
+
+            header_written = true;
+            return true;
+        });
+    }
+
+    void data_log::scan_values(const std::vector<size_t> &columns, int64_t from_ms, int64_t to_ms, 
+        const std::function<bool(int64_t time_ms, const std::vector<float> &values)> &visit) const {
+        if (raw_log) {
+            throw std::logic_error("Raw logs have no values");
+        }
+
+        const std::chrono::system_clock::time_point from_time{std::chrono::milliseconds(from_ms)};
+
+        // Rows are in order of time, so the scan ends at the first one past the range
+        auto visit_in_range = [&](int64_t time_ms, const std::vector<float> &values) {
+            if (time_ms >= to_ms) {
+                return false;
+            }
+
+            return time_ms < from_ms || visit(time_ms, values);
+        };
+
+        // CSV rows only carry the local time of day, the date is counted from the start of the log
+        int64_t day_start_ms = get_day_start_ms(get_start_time());
+        int64_t last_time_of_day_ms = 0;
+        std::vector<float> values(columns.size());
+        std::vector<std::string_view> fields;
+        std::string line;
+
+        for_each_segment([&](const log_segment &segment) {
+            if (format == log_format::BINARY) {
+                // Segments closed before the range starts are skipped without reading them
+                if (std::chrono::file_clock::to_sys(segment.write_time) < from_time) {
+                    return true;
+                }
+
+                return binary_log_reader(segment.path, segment.encoding).scan_values(columns, visit_in_range);
+            }
+
+            bool is_header = true;
+            bool has_times = true;
+            line.clear();
+
+            return read_segment(segment, [&](const char *data, size_t size) {
+                while (size > 0) {
+                    const char *end = static_cast<const char *>(std::memchr(data, '\n', size));
+
+                    if (end == nullptr) {
+                        line.append(data, size);
+                        return true;
+                    }
+
+                    line.append(data, end - data);
+                    size -= end + 1 - data;
+                    data = end + 1;
+
+                    int64_t time_of_day_ms;
+                    bool is_row = !is_header && parse_csv_values(line, columns, has_times, fields, time_of_day_ms, values);
+
+                    if (is_header) {
+                        has_times = get_has_value_times(line);
+                    }
+
+                    is_header = false;
+                    line.clear();
+
+                    if (!is_row) {
+                        continue;
+                    }
+
+                    // The time of day went back, so midnight passed
+                    if (time_of_day_ms + 12 * 3600 * 1000 < last_time_of_day_ms) {
+                        day_start_ms += 24 * 3600 * 1000;
+                    }
+
+                    last_time_of_day_ms = time_of_day_ms;
+
+                    if (!visit_in_range(day_start_ms + time_of_day_ms, values)) {
+                        return false;
+                    }
+                }
+
+                return true;
+            });
+        });
     }
 
     const std::string &data_log::get_name() const {
         return name;
     }
 
-    const std::string &data_log::get_csv_string() {
-        // When not currently logging, return the cached CSV string
-        if (!logger.get_is_active() && !csv_string.empty()) {
-            return csv_string;
+    std::string data_log::get_csv_string() const {
+        // Not cached, large logs are streamed through write_csv() instead
+        std::string csv;
+
+        write_csv([&csv](const char *data, size_t size) {
+            csv.append(data, size);
+            return true;
+        });
+
+        return csv;
+    }
+
+    std::string data_log::get_segment_path(uint32_t index) const {
+        std::string path = directory + "/" + name;
+
+        // The first segment keeps the name logs had before they were segmented
+        if (index > 0) {
+            path += "." + std::to_string(index);
         }
-        
-        std::ifstream csv_file(directory + "/" + name + ".csv");
 
-        if (!csv_file.is_open()) {
-            throw std::system_error(std::error_code(errno, std::generic_category()));
+        return path + get_log_extension(format);
+    }
+
+    std::vector<log_segment> data_log::get_segments() const {
+        uint32_t count;
+        bool active;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            count = segment_count;
+            active = is_logging;
         }
 
-        std::stringstream ss;
-        ss << csv_file.rdbuf();
+        std::vector<log_segment> segments;
+
+        for (uint32_t i = 0; i < count; i++) {
+            std::optional<log_segment> segment = find_segment(i, active && i == count - 1);
 
-        csv_string = ss.str();
+            if (segment) {
+                segments.push_back(std::move(*segment));
+            }
+        }
 
-        return csv_string;
+        return segments;
     }
 
     size_t data_log::get_file_size() const {
-        return file_size;
+        size_t size = 0;
+
+        for (const log_segment &segment : get_segments()) {
+            size += segment.size;
+        }
+
+        return size;
+    }
+
+    std::vector<std::string> data_log::get_columns() const {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (!header.empty()) {
+                return header;
+            }
+        }
+
+        // Logs loaded from disk only know their columns from the header of their first segment
+        std::vector<std::string> columns;
+
+        for_each_segment([&](const log_segment &segment) {
+            if (format == log_format::BINARY) {
+                columns = binary_log_reader(segment.path, segment.encoding).get_columns();
+                return false;
+            }
+
+            std::string line;
+
+            read_segment(segment, [&line](const char *data, size_t size) {
+                const char *end = static_cast<const char *>(std::memchr(data, '\n', size));
+                line.append(data, end == nullptr ? size : end - data);
+
+                return end == nullptr;
+            });
+
+            // Every column of a value log is followed by the time its value was received (see csv_logger),
+            // apart from logs written before value times were recorded
+            bool has_times = !raw_log && get_has_value_times(line);
+            std::istringstream ss(line);
+            std::string column;
+
+            for (size_t i = 0; std::getline(ss, column, ';'); i++) {
+                if (i > 0 && (!has_times || i % 2 == 1)) {
+                    columns.push_back(column);
+                }
+            }
+
+            return false;
+        });
+
+        std::lock_guard<std::mutex> lock(mutex);
+        header = columns;
+
+        return columns;
+    }
+
+    std::chrono::system_clock::time_point data_log::get_start_time() const {
+        return start_time;
+    }
+
+    std::chrono::system_clock::time_point data_log::get_end_time() const {
+        std::vector<log_segment> segments = get_segments();
+
+        if (is_logging || segments.empty()) {
+            return is_logging ? std::chrono::system_clock::now() : start_time;
+        }
+
+        return std::chrono::time_point_cast<std::chrono::system_clock::duration>(
+            std::chrono::file_clock::to_sys(segments.back().write_time));
+    }
+
+    size_t data_log::get_data_size() const {
+        size_t size = 0;
+
+        // Only an estimate for segments that cannot be read, they fail once they are read as a whole
+        for (const log_segment &segment : get_segments()) {
+            try {
+                size += segment.encoding == content_encoding::NONE 
+                    ? segment.size 
+                    : get_decompressed_size(segment.path, segment.encoding);
+            }
+            catch (const std::exception &e) {
+                size += segment.size;
+            }
+        }
+
+        return size;
     }
 
     bool data_log::get_is_logging() const {
-        return logger.get_is_active();
+        return is_logging;
     }
 
     bool data_log::get_is_raw() const {
         return raw_log;
     }
 
+    log_format data_log::get_format() const {
+        return format;
+    }
+
+    uint64_t data_log::get_overruns() const {
+        return overruns;
+    }
+
     const std::vector<UUIDv4::UUID> &data_log::get_request_ids() const {
         return requests;
     }
 
-    size_t data_log::read_file_size() const {
-        try {
-            return std::filesystem::file_size(directory + "/" + name + ".csv");
+    size_t data_log::get_record_size() const {
+        size_t column_size = raw_log ? 1 + value_table::MAX_RAW_SIZE : sizeof(value_sample);
+        return sizeof(int64_t) + requests.size() * column_size;
+    }
+
+    void data_log::write_record(const uint8_t *record) {
+        int64_t t;
+        std::memcpy(&t, record, sizeof(t));
+        record += sizeof(t);
+
+        std::chrono::system_clock::time_point time{std::chrono::system_clock::duration(t)};
+
+        if (raw_log) {
+            std::vector<std::vector<uint8_t>> row(requests.size());
+
+            for (auto &col : row) {
+                col.assign(record + 1, record + 1 + record[0]);
+                record += 1 + value_table::MAX_RAW_SIZE;
+            }
+
+            if (!std::visit([&](auto &l) { return l.write_row_raw(time, row); }, logger)) {
+                overruns++;
+            }
+
+            return;
+        }
+
+        std::vector<value_sample> row(requests.size());
+
+        for (auto &col : row) {
+            std::memcpy(&col, record, sizeof(col));
+            record += sizeof(col);
+        }
+
+        if (!std::visit([&](auto &l) { return l.write_row(time, row); }, logger)) {
+            overruns++;
+        }
+    }
+
+    // Replacing the logger must not leave the variant without a value
+    static_assert(std::is_nothrow_move_constructible_v<csv_logger> && std::is_nothrow_move_constructible_v<binary_logger>);
+
+    void data_log::open_segment(uint32_t index) {
+        const std::string filename = get_segment_path(index);
+
+        // The new logger is complete before it replaces the current one, which is only closed once that succeeded
+        if (format == log_format::BINARY) {
+            logger = binary_logger(header, filename, raw_log, start_time);
+        }
+        else {
+            logger = csv_logger(header, filename, raw_log, start_time);
         }
-        catch (const std::exception &e) {
-            throw std::runtime_error(e.what());
+
+        segment_start_time = std::chrono::system_clock::now();
+    }
+
+    bool data_log::get_segment_full() const {
+        size_t size = std::visit([](const auto &l) { return l.get_size(); }, logger);
+
+        return (limits.max_bytes > 0 && size >= limits.max_bytes) 
+            || (limits.max_duration.count() > 0 
+                && std::chrono::system_clock::now() - segment_start_time >= limits.max_duration);
+    }
+
+    std::optional<log_segment> data_log::find_segment(uint32_t index, bool active) const {
+        const std::string path = get_segment_path(index);
+
+        // A segment that is being compressed exists twice for a moment, either file is complete
+        for (content_encoding encoding : { content_encoding::NONE, SEGMENT_ENCODING }) {
+            std::string encoded_path = path + get_file_extension(encoding);
+            std::error_code ec;
+            size_t size = std::filesystem::file_size(encoded_path, ec);
+
+            if (ec) {
+                continue;
+            }
+
+            auto write_time = std::filesystem::last_write_time(encoded_path, ec);
+
+            if (ec) {
+                continue;
+            }
+
+            return log_segment{ index, encoded_path, encoding, size, write_time, active };
         }
+
+        return std::nullopt;
+    }
+
+    bool data_log::for_each_segment(const std::function<bool(const log_segment &segment)> &read) const {
+        uint32_t count;
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            count = segment_count;
+        }
+
+        for (uint32_t i = 0; i < count; i++) {
+            // Segments are compressed or removed in the background, so each one is looked up right before 
+            // it is opened, and once more if it was compressed in between
+            for (uint32_t attempt = 0; ; attempt++) {
+                std::optional<log_segment> segment = find_segment(i, false);
+
+                if (!segment) {
+                    break;
+                }
+
+                try {
+                    if (!read(*segment)) {
+                        return false;
+                    }
+
+                    break;
+                }
+                catch (const std::system_error &e) {
+                    if (attempt > 0 || e.code() != std::errc::no_such_file_or_directory) {
+                        throw;
+                    }
+                }
+            }
+        }
+
+        return true;
+    }
+
+    bool data_log::read_segment(const log_segment &segment, 
+        const std::function<bool(const char *data, size_t size)> &sink) const {
+        if (segment.encoding != content_encoding::NONE) {
+            return decompress_file(segment.path, segment.encoding, sink);
+        }
+
+        std::ifstream file(segment.path, std::ios::binary);
+
+        if (!file.is_open()) {
+            throw std::system_error(std::error_code(errno, std::generic_category()));
+        }
+
+        std::vector<char> chunk(EXPORT_CHUNK_SIZE);
+
+        while (file.read(chunk.data(), chunk.size()) || file.gcount() > 0) {
+            if (!sink(chunk.data(), file.gcount())) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool data_log::write_segment_csv(const log_segment &segment, bool with_header, 
+        const std::function<bool(const char *data, size_t size)> &sink) const {
+        if (format == log_format::BINARY) {
+            binary_log_reader reader(segment.path, segment.encoding);
+            std::string chunk;
+
+            if (with_header) {
+                reader.format_csv_header(chunk);
+            }
+
+            return reader.format_csv_rows(chunk, EXPORT_CHUNK_RECORDS, [&sink](std::string &chunk) {
+                bool more = chunk.empty() || sink(chunk.data(), chunk.size());
+                chunk.clear();
+
+                return more;
+            });
+        }
+
+        // CSV segments are passed through, apart from the header line of all but the first
+        bool skip_header = !with_header;
+
+        auto filter = [&](const char *data, size_t size) {
+            if (skip_header) {
+                const char *end = static_cast<const char *>(std::memchr(data, '\n', size));
+
+                if (end == nullptr) {
+                    return true;
+                }
+
+                skip_header = false;
+                size -= end + 1 - data;
+                data = end + 1;
+            }
+
+            return size == 0 || sink(data, size);
+        };
+
+        return read_segment(segment, filter);
+    }
+
+    bool data_log::get_has_value_times(const std::string &header_line) {
+        std::vector<std::string> columns;
+        std::istringstream ss(header_line);
+        std::string column;
+
+        while (std::getline(ss, column, ';')) {
+            columns.push_back(column);
+        }
+
+        if (columns.size() < 3 || columns.size() % 2 == 0) {
+            return false;
+        }
+
+        for (size_t i = 1; i < columns.size(); i += 2) {
+            if (columns[i + 1] != columns[i] + " timestamp") {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool data_log::parse_csv_values(const std::string &line, const std::vector<size_t> &columns, bool has_times, 
+        std::vector<std::string_view> &fields, int64_t &time_of_day_ms, std::vector<float> &values) {
+        fields.clear();
+
+        for (size_t start = 0; ; ) {
+            size_t end = line.find(';', start);
+            fields.emplace_back(line.data() + start, (end == std::string::npos ? line.size() : end) - start);
+
+            if (end == std::string::npos) {
+                break;
+            }
+
+            start = end + 1;
+        }
+
+        // HH:MM:SS.mmm
+        std::string_view time = fields.front();
+        auto digits = [&time](size_t pos, size_t count) {
+            int64_t value = 0;
+
+            for (size_t i = pos; i < pos + count; i++) {
+                if (time[i] < '0' || time[i] > '9') {
+                    return int64_t(-1);
+                }
+
+                value = value * 10 + (time[i] - '0');
+            }
+
+            return value;
+        };
+
+        if (time.size() != 12) {
+            return false;
+        }
+
+        int64_t h = digits(0, 2), m = digits(3, 2), s = digits(6, 2), ms = digits(9, 3);
+
+        if (h < 0 || m < 0 || s < 0 || ms < 0) {
+            return false;
+        }
+
+        time_of_day_ms = ((h * 60 + m) * 60 + s) * 1000 + ms;
+
+        // Every value is followed by the time it was received, which is empty if it never was
+        for (size_t c = 0; c < columns.size(); c++) {
+            size_t field = has_times ? 1 + 2 * columns[c] : 1 + columns[c];
+
+            if (field + (has_times ? 1 : 0) >= fields.size()) {
+                return false;
+            }
+
+            std::string_view value = fields[field];
+            auto result = std::from_chars(value.data(), value.data() + value.size(), values[c]);
+
+            if (result.ec != std::errc() || (has_times && fields[field + 1].empty())) {
+                values[c] = std::numeric_limits<float>::quiet_NaN();
+            }
+        }
+
+        return true;
+    }
+
+    int64_t data_log::get_day_start_ms(std::chrono::system_clock::time_point time) {
+        std::time_t t = std::chrono::system_clock::to_time_t(time);
+        std::tm tm;
+
+        localtime_r(&t, &tm);
+        tm.tm_hour = 0;
+        tm.tm_min = 0;
+        tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+
+        return static_cast<int64_t>(std::mktime(&tm)) * 1000;
     }
 
     std::string data_log::generate_name() const {
@@ -153,12 +720,65 @@ namespace obd2_server {
         return oss.str();
     }
 
+    log_format get_log_format(const std::string &extension) {
+        if (extension == ".bin") {
+            return log_format::BINARY;
+        }
+
+        if (extension == ".csv") {
+            return log_format::CSV;
+        }
+
+        throw std::invalid_argument("Unknown log format " + extension);
+    }
+
+    std::string get_log_extension(log_format format) {
+        return format == log_format::BINARY ? ".bin" : ".csv";
+    }
+
+    void to_json(nlohmann::json &j, const log_format &format) {
+        j = format == log_format::BINARY ? "binary" : "csv";
+    }
+
+    void from_json(const nlohmann::json &j, log_format &format) {
+        std::string name = j.template get<std::string>();
+
+        if (name == "binary") {
+            format = log_format::BINARY;
+        }
+        else if (name == "csv") {
+            format = log_format::CSV;
+        }
+        else {
+            throw std::invalid_argument("Unknown log format " + name);
+        }
+    }
+
+    void to_json(nlohmann::json &j, const log_segment &segment) {
+        j = nlohmann::json{
+            {"index", segment.index},
+            {"size", segment.size},
+            {"compressed", segment.encoding != content_encoding::NONE},
+            {"active", segment.active}
+        };
+    }
+
     void to_json(nlohmann::json &j, const data_log &log) {
+        std::vector<log_segment> segments = log.get_segments();
+        size_t size = 0;
+
+        for (const log_segment &segment : segments) {
+            size += segment.size;
+        }
+
         j = nlohmann::json{
             {"name", log.get_name()},
             {"is_logging", log.get_is_logging()},
             {"raw_log", log.get_is_raw()},
-            {"size", log.get_file_size()}
+            {"format", log.get_format()},
+            {"size", size},
+            {"segments", segments},
+            {"overruns", log.get_overruns()}
         };
     }
 }
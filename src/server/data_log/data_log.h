@@ -1,50 +1,159 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
 #include <unordered_map>
 #include <string>
+#include <string_view>
+#include <variant>
 #include <json.hpp>
 #include <uuid_v4.h>
 
+#include "binary_logger/binary_logger.h"
 #include "csv_logger/csv_logger.h"
+#include "record_ring/record_ring.h"
+#include "../compression/compression.h"
+#include "../obd2_bridge/value_table/value_table.h"
 
 namespace obd2_server {
+    enum class log_format {
+        CSV,
+        BINARY  // See binary_logger, converted to CSV when it is read
+    };
+
+    // A running log continues in a new segment file once its current one reaches either limit, 0 = no limit
+    struct segment_limits {
+        size_t max_bytes = 0;
+        std::chrono::seconds max_duration{0};
+    };
+
+    // Segment files are named <log name>[.<index>]<extension>[<compression extension>], 
+    // each one starts with its own header
+    struct log_segment {
+        uint32_t index;
+        std::string path;
+        content_encoding encoding; // NONE until the closed segment is compressed
+        size_t size;
+        std::filesystem::file_time_type write_time;
+        bool active;
+    };
+
     class data_log {
         public:
             data_log();
-            data_log(const std::string &name, const std::string &directory);
+            data_log(const std::string &name, const std::string &directory, log_format format = log_format::CSV, 
+                uint32_t segment_count = 1);
             data_log(const std::unordered_map<UUIDv4::UUID, std::string> &requests, 
                 const std::string &directory,
-                bool raw_log = false);
+                bool raw_log = false,
+                log_format format = log_format::CSV,
+                segment_limits limits = segment_limits(),
+                size_t ring_capacity = DEFAULT_RING_CAPACITY);
+            data_log(const data_log &l) = delete;
+            data_log(data_log &&l) = delete;
+
+            data_log &operator=(const data_log &l) = delete;
+            data_log &operator=(data_log &&l) = delete;
+
+            static const size_t DEFAULT_RING_CAPACITY;
+            static const content_encoding SEGMENT_ENCODING;
+
+            // Only called by the thread that samples the log. The row is queued for write_pending(), 
+            // rows that do not fit into the ring, or later into the file buffer, are dropped and counted as overruns
+            void add_data(std::chrono::system_clock::time_point time, 
+                const std::function<value_sample(const UUIDv4::UUID &id)> &get_sample);
+            void add_data_raw(std::chrono::system_clock::time_point time, 
+                const std::function<std::vector<uint8_t>(const UUIDv4::UUID &id)> &get_raw);
 
-            void add_data(const std::unordered_map<UUIDv4::UUID, float> &data);
-            void add_data_raw(const std::unordered_map<UUIDv4::UUID, std::vector<uint8_t>> &data);
-            void stop_logging();
+            // Writes the queued rows to the file and starts a new segment when the current one is full, 
+            // returns the count of rows
+            size_t write_pending(bool sync = false);
+            bool stop_logging(); // False if the log was not running
+            std::vector<std::string> take_closed_segments(); // Paths of the segments closed since the last call
+
+            // The CSV of all segments, the header is only written once. False if sink returned false
+            bool write_csv(const std::function<bool(const char *data, size_t size)> &sink) const;
+
+            // Values of the given columns for every row in [from_ms, to_ms) of a value log, in order of time. 
+            // Values that were never received are NaN. Stops when visit returns false
+            void scan_values(const std::vector<size_t> &columns, int64_t from_ms, int64_t to_ms, 
+                const std::function<bool(int64_t time_ms, const std::vector<float> &values)> &visit) const;
 
             const std::string &get_name() const;
-            const std::string &get_csv_string();
+            std::string get_csv_string() const;
+            std::string get_segment_path(uint32_t index) const; // Without compression extension
+            std::vector<log_segment> get_segments() const; // Segments on disk, in order
             size_t get_file_size() const;
+            size_t get_data_size() const; // Size of the segments once decompressed
+            std::vector<std::string> get_columns() const;
+            std::chrono::system_clock::time_point get_start_time() const;
+            std::chrono::system_clock::time_point get_end_time() const; // Now while logging, else when the last segment was closed
             bool get_is_logging() const;
             bool get_is_raw() const;
+            log_format get_format() const;
+            uint64_t get_overruns() const;
             const std::vector<UUIDv4::UUID> &get_request_ids() const;
 
         private:
             const std::string RAW_LOG_PREFIX = "raw_";
 
+            static const size_t EXPORT_CHUNK_SIZE;
+            static const size_t EXPORT_CHUNK_RECORDS;
+
             std::vector<UUIDv4::UUID> requests;
-            std::unordered_map<UUIDv4::UUID, size_t> col_indices;
+            mutable std::vector<std::string> header; // Read from the files on first use for logs loaded from disk
 
             std::string name;
             std::string directory;
-            std::string csv_string;
-            size_t file_size = 0;
-            csv_logger logger;
+
+            // Rows are queued on the sampling thread without locking. The log writer and 
+            // HTTP workers stopping the log take turns as the consumer through mutex
+            std::unique_ptr<record_ring> ring;
+            std::atomic<bool> is_logging = false;
+            std::atomic<uint64_t> overruns = 0;
+
+            mutable std::mutex mutex;
+            std::variant<csv_logger, binary_logger> logger;
 
             bool raw_log = false;
+            log_format format = log_format::CSV;
+
+            // Every segment keeps the start time of the log, so raw timestamps continue across segments
+            segment_limits limits;
+            uint32_t segment_count = 1;
+            std::chrono::system_clock::time_point start_time;
+            std::chrono::system_clock::time_point segment_start_time;
+            std::vector<std::string> closed_segments;
 
-            size_t read_file_size() const;
+            size_t get_record_size() const;
+            void write_record(const uint8_t *record);
+            void open_segment(uint32_t index);
+            bool get_segment_full() const;
+            std::optional<log_segment> find_segment(uint32_t index, bool active) const;
+            bool for_each_segment(const std::function<bool(const log_segment &segment)> &read) const;
+            bool read_segment(const log_segment &segment, 
+                const std::function<bool(const char *data, size_t size)> &sink) const;
+            bool write_segment_csv(const log_segment &segment, bool with_header, 
+                const std::function<bool(const char *data, size_t size)> &sink) const;
             std::string generate_name() const;
+
+            static bool get_has_value_times(const std::string &header_line); // CSV logs from before value times have none
+            static bool parse_csv_values(const std::string &line, const std::vector<size_t> &columns, bool has_times, 
+                std::vector<std::string_view> &fields, int64_t &time_of_day_ms, std::vector<float> &values);
+            static int64_t get_day_start_ms(std::chrono::system_clock::time_point time); // Local midnight
     };
 
+    log_format get_log_format(const std::string &extension); // Extension with the dot
+    std::string get_log_extension(log_format format);
+
+    void to_json(nlohmann::json &j, const log_format &format);
+    void from_json(const nlohmann::json &j, log_format &format);
+    void to_json(nlohmann::json &j, const log_segment &segment);
     void to_json(nlohmann::json &j, const data_log &log);
 }
\ No newline at end of file
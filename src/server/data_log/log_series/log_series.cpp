@@ -0,0 +1,92 @@
+#include "log_series.h"
+
+#include <cmath>
+
+namespace obd2_server {
+    log_series::log_series(const std::vector<std::string> &keys, int64_t from_ms, int64_t to_ms, size_t buckets) : 
+        keys(keys), from_ms(from_ms), to_ms(to_ms), bucket_count(buckets) {
+        // Rounded up, so the last bucket ends at or after to_ms
+        int64_t span = to_ms - from_ms;
+        bucket_ms = span / static_cast<int64_t>(buckets) + (span % static_cast<int64_t>(buckets) != 0);
+        this->buckets.resize(keys.size() * buckets);
+    }
+
+    bool log_series::add(int64_t time_ms, const std::vector<float> &values) {
+        if (time_ms >= to_ms) {
+            return false;
+        }
+
+        if (time_ms < from_ms) {
+            return true;
+        }
+
+        size_t i = (time_ms - from_ms) / bucket_ms;
+
+        for (size_t k = 0; k < keys.size(); k++) {
+            float value = values[k];
+
+            if (std::isnan(value)) {
+                continue;
+            }
+
+            bucket &b = buckets[k * bucket_count + i];
+
+            if (b.count == 0 || value < b.min) {
+                b.min = value;
+            }
+
+            if (b.count == 0 || value > b.max) {
+                b.max = value;
+            }
+
+            b.sum += value;
+            b.last = value;
+            b.count++;
+        }
+
+        return true;
+    }
+
+    void to_json(nlohmann::json &j, const log_series &s) {
+        j = {
+            {"from", s.from_ms},
+            {"to", s.to_ms},
+            {"buckets", s.bucket_count},
+            {"bucket_ms", s.bucket_ms},
+            {"series", nlohmann::json::object()}
+        };
+
+        for (size_t k = 0; k < s.keys.size(); k++) {
+            nlohmann::json min = nlohmann::json::array(), max = nlohmann::json::array(), mean = nlohmann::json::array();
+            nlohmann::json last = nlohmann::json::array(), count = nlohmann::json::array();
+
+            // Empty buckets are null, so gaps in the log stay visible
+            for (size_t i = 0; i < s.bucket_count; i++) {
+                const log_series::bucket &b = s.buckets[k * s.bucket_count + i];
+
+                if (b.count == 0) {
+                    min.push_back(nullptr);
+                    max.push_back(nullptr);
+                    mean.push_back(nullptr);
+                    last.push_back(nullptr);
+                }
+                else {
+                    min.push_back(b.min);
+                    max.push_back(b.max);
+                    mean.push_back(static_cast<float>(b.sum / b.count));
+                    last.push_back(b.last);
+                }
+
+                count.push_back(b.count);
+            }
+
+            j["series"][s.keys[k]] = {
+                {"min", min},
+                {"max", max},
+                {"mean", mean},
+                {"last", last},
+                {"count", count}
+            };
+        }
+    }
+}
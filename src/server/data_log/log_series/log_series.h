@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <json.hpp>
+#include <string>
+#include <vector>
+
+namespace obd2_server {
+    // Values of a log reduced to a fixed number of equally long time buckets per column
+    class log_series {
+        public:
+            log_series(const std::vector<std::string> &keys, int64_t from_ms, int64_t to_ms, size_t buckets);
+
+            // Values in order of keys, NaN values are skipped. False once time_ms is past the range
+            bool add(int64_t time_ms, const std::vector<float> &values);
+
+            friend void to_json(nlohmann::json &j, const log_series &s);
+
+        private:
+            struct bucket {
+                float min;
+                float max;
+                double sum = 0;
+                float last;
+                uint32_t count = 0;
+            };
+
+            std::vector<std::string> keys;
+            int64_t from_ms;
+            int64_t to_ms;
+            int64_t bucket_ms;
+            size_t bucket_count;
+            std::vector<bucket> buckets; // Bucket i of key k at k * bucket_count + i
+    };
+}
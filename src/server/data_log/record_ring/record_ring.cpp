@@ -0,0 +1,48 @@
+#include "record_ring.h"
+
+#include <algorithm>
+#include <bit>
+
+namespace obd2_server {
+    record_ring::record_ring(size_t record_size, size_t capacity) 
+        : record_size(record_size), capacity(std::bit_ceil(std::max<size_t>(capacity, 1))) {
+        buffer = std::make_unique<uint8_t[]>(this->record_size * this->capacity);
+    }
+
+    uint8_t *record_ring::try_reserve() {
+        size_t h = head.load(std::memory_order_relaxed);
+
+        if (h - tail.load(std::memory_order_acquire) >= capacity) {
+            return nullptr;
+        }
+
+        return buffer.get() + (h & (capacity - 1)) * record_size;
+    }
+
+    void record_ring::commit() {
+        head.store(head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    size_t record_ring::drain(const std::function<void(const uint8_t *record)> &consume) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        const size_t h = head.load(std::memory_order_acquire);
+        const size_t count = h - t;
+
+        for (; t != h; t++) {
+            consume(buffer.get() + (t & (capacity - 1)) * record_size);
+        }
+
+        // The records are only handed back to the producer once all of them were consumed
+        tail.store(t, std::memory_order_release);
+
+        return count;
+    }
+
+    size_t record_ring::get_record_size() const {
+        return record_size;
+    }
+
+    size_t record_ring::get_capacity() const {
+        return capacity;
+    }
+}
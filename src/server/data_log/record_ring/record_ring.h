@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+namespace obd2_server {
+    // Lock-free ring of fixed-size records between exactly one producer and one consumer
+    class record_ring {
+        public:
+            record_ring(size_t record_size, size_t capacity); // Capacity is rounded up to a power of two
+            record_ring(const record_ring &r) = delete;
+            record_ring(record_ring &&r) = delete;
+
+            record_ring &operator=(const record_ring &r) = delete;
+            record_ring &operator=(record_ring &&r) = delete;
+
+            // Producer side: the reserved record becomes visible with commit(), nullptr means the ring is full
+            uint8_t *try_reserve();
+            void commit();
+
+            // Consumer side: hands every committed record to consume in order, returns their count
+            size_t drain(const std::function<void(const uint8_t *record)> &consume);
+
+            size_t get_record_size() const;
+            size_t get_capacity() const;
+
+        private:
+            std::unique_ptr<uint8_t[]> buffer;
+            size_t record_size;
+            size_t capacity;
+
+            // Kept on separate cache lines, so producer and consumer do not invalidate each other's
+            alignas(64) std::atomic<size_t> head = 0; // Next record to write
+            alignas(64) std::atomic<size_t> tail = 0; // Next record to read
+    };
+}
@@ -0,0 +1,54 @@
+#include "metered_task_queue.h"
+
+namespace obd2_server {
+    metered_task_queue::metered_task_queue(size_t threads, task_queue_metrics &metrics) 
+        : pool(threads), metrics(metrics) {
+        metrics.threads = threads;
+    }
+
+    bool metered_task_queue::enqueue(std::function<void()> fn) {
+        const auto queued = std::chrono::steady_clock::now();
+
+        metrics.queue_depth++;
+
+        bool accepted = pool.enqueue([this, fn = std::move(fn), queued]() {
+            uint64_t wait_us = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - queued).count();
+            uint64_t max_wait_us = metrics.max_wait_us.load();
+
+            metrics.queue_depth--;
+            metrics.busy_threads++;
+            metrics.tasks++;
+            metrics.total_wait_us += wait_us;
+
+            while (wait_us > max_wait_us && !metrics.max_wait_us.compare_exchange_weak(max_wait_us, wait_us)) { }
+
+            fn();
+
+            metrics.busy_threads--;
+        });
+
+        if (!accepted) {
+            metrics.queue_depth--;
+        }
+
+        return accepted;
+    }
+
+    void metered_task_queue::shutdown() {
+        pool.shutdown();
+    }
+
+    void to_json(nlohmann::json &j, const task_queue_metrics &m) {
+        uint64_t tasks = m.tasks;
+
+        j = nlohmann::json{
+            {"threads", m.threads.load()},
+            {"busy_threads", m.busy_threads.load()},
+            {"queue_depth", m.queue_depth.load()},
+            {"connections", tasks},
+            {"avg_wait_ms", tasks ? m.total_wait_us / 1000.0 / tasks : 0.0},
+            {"max_wait_ms", m.max_wait_us / 1000.0}
+        };
+    }
+}
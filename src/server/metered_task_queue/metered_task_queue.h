@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <httplib.h>
+#include <json.hpp>
+
+namespace obd2_server {
+    // Counters of a metered_task_queue. Owned by the server, 
+    // as httplib destroys its task queue when it stops listening
+    struct task_queue_metrics {
+        std::atomic<size_t> threads = 0;
+        std::atomic<size_t> queue_depth = 0;
+        std::atomic<size_t> busy_threads = 0;
+        std::atomic<uint64_t> tasks = 0;
+        std::atomic<uint64_t> total_wait_us = 0;
+        std::atomic<uint64_t> max_wait_us = 0;
+    };
+
+    // httplib thread pool that records how long connections wait for a worker
+    class metered_task_queue : public httplib::TaskQueue {
+        public:
+            metered_task_queue(size_t threads, task_queue_metrics &metrics);
+            metered_task_queue(const metered_task_queue &q) = delete;
+            metered_task_queue(metered_task_queue &&q) = delete;
+
+            metered_task_queue &operator=(const metered_task_queue &q) = delete;
+            metered_task_queue &operator=(metered_task_queue &&q) = delete;
+
+            bool enqueue(std::function<void()> fn) override;
+            void shutdown() override;
+
+        private:
+            httplib::ThreadPool pool;
+            task_queue_metrics &metrics;
+    };
+
+    void to_json(nlohmann::json &j, const task_queue_metrics &m);
+}
@@ -1,7 +1,17 @@
 #include "obd2_bridge.h"
 
+#include <cmath>
+
 namespace obd2_server {
     const std::chrono::milliseconds obd2_bridge::CONNECTION_CHECK_INTERVAL = std::chrono::milliseconds(5000);
+    const std::chrono::milliseconds obd2_bridge::CONNECTION_RETRY_INTERVAL = std::chrono::milliseconds(1000);
+    const std::chrono::milliseconds obd2_bridge::DISCOVERY_WINDOW = std::chrono::milliseconds(150);
+    const uint32_t obd2_bridge::MIN_REFRESH_MS = 10;
+    const size_t obd2_bridge::MAX_SLOTS = 1024;
+    const size_t obd2_bridge::INVALID_SLOT = std::numeric_limits<size_t>::max();
+    const uint32_t obd2_bridge::STALE_REFRESH_CYCLES = 3;
+    const uint32_t obd2_bridge::ANY_PID = 0x10000;
+    const float obd2_bridge::DEADBAND_FRACTION = 0.005f;
     
     // Typical CAN bus bitrates for obd2
     const uint32_t obd2_bridge::BITRATES[] = { 
@@ -10,11 +20,17 @@ namespace obd2_server {
         125000, // 125kHz
     };
 
-    obd2_bridge::obd2_bridge() { }
+    const size_t obd2_bridge::BITRATE_COUNT = sizeof(BITRATES) / sizeof(BITRATES[0]);
+
+    obd2_bridge::obd2_bridge() 
+        : request_slots(std::make_shared<const std::unordered_map<UUIDv4::UUID, size_t>>()), values(MAX_SLOTS) { }
 
     obd2_bridge::obd2_bridge(const std::string &device, bool skip_can_setup, bool enable_bitrate_discovery,
         uint32_t bitrate, uint32_t refresh_ms, bool enable_pid_chaining)
-        : can_bitrate(bitrate), can_device(device), skip_can_setup(skip_can_setup), enable_bitrate_discovery(enable_bitrate_discovery) { 
+        : request_slots(std::make_shared<const std::unordered_map<UUIDv4::UUID, size_t>>()), values(MAX_SLOTS),
+        refresh_ms(refresh_ms), tick_ms(refresh_ms), can_bitrate(bitrate), can_device(device), 
+        skip_can_setup(skip_can_setup), enable_bitrate_discovery(enable_bitrate_discovery), 
+        enable_pid_chaining(enable_pid_chaining) { 
 
         setup_can_device();
 
@@ -25,6 +41,10 @@ namespace obd2_server {
         // Also start connection loop
         connection_thread_running = true;
         connection_thread = std::thread(&obd2_bridge::connection_loop, this);
+
+        // And timestamp responses as they come in
+        capture_thread_running = true;
+        capture_thread = std::thread(&obd2_bridge::capture_loop, this);
     }
 
     obd2_bridge::~obd2_bridge() {
@@ -32,6 +52,11 @@ namespace obd2_server {
             connection_thread_running = false;
             connection_thread.join();
         }
+
+        if (capture_thread_running) {
+            capture_thread_running = false;
+            capture_thread.join();
+        }
     }
 
     void obd2_bridge::connection_loop() {
@@ -39,14 +64,26 @@ namespace obd2_server {
             // Cycle bitrates if connection is not active
             while (!(is_connected = instance.is_connection_active())
                 && connection_thread_running) {
+                reset_pid_support();
+
                 if (!enable_bitrate_discovery) {
                     std::cout << "No connection active" << std::endl;
+                    std::this_thread::sleep_for(CONNECTION_RETRY_INTERVAL);
                     continue;
                 }
 
                 try {
-                    std::cout << "No connection active. Trying next bitrate..." << std::endl;
-                    set_next_bitrate();
+                    uint32_t bitrate = discover_bitrate();
+
+                    // Fall back to actively trying bitrates when the bus was silent or cannot be listened to
+                    if (bitrate != 0) {
+                        std::cout << "No connection active. Found traffic at " << bitrate << " bit/s" << std::endl;
+                        set_can_bitrate(bitrate);
+                    }
+                    else {
+                        std::cout << "No connection active. Trying next bitrate..." << std::endl;
+                        set_next_bitrate();
+                    }
                 }
                 catch (const std::exception &e) {
                     std::cerr << "Error changing bitrate: " << e.what() << std::endl;
@@ -55,57 +92,149 @@ namespace obd2_server {
 
             std::cout << "Connection active" << std::endl;
 
+            if (!support_loaded) {
+                load_pid_support();
+            }
+
             const auto start = std::chrono::steady_clock::now();
             const auto end = start + CONNECTION_CHECK_INTERVAL;
             const auto sleep_time = std::chrono::milliseconds(1000);
 
             while (connection_thread_running && std::chrono::steady_clock::now() < end) {
                 std::this_thread::sleep_for(sleep_time);
+                evict_idle_requests();
             }
         }
     }
 
+    obd2_bridge::scheduled_request::scheduled_request(const obd2_server::request &request, obd2::obd2 &instance, size_t slot)
+        : instance(request.ecu, request.service, request.pid, instance, request.formula, true), slot(slot),
+        ecu(request.ecu), service(request.service), pid(request.pid), refresh_ms(request.refresh_ms), 
+        polling(true), leases(0) { }
+
     bool obd2_bridge::register_request(const obd2_server::request &request) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
         if (requests.find(request.id) != requests.end()) {
             return false;
         }
 
-        requests.try_emplace(request.id, request.ecu, request.service, request.pid, instance, request.formula, true);
+        add_request(request);
         return true;
     }
 
     bool obd2_bridge::unregister_request(const UUIDv4::UUID &id) {
-        if (requests.find(id) == requests.end()) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+        auto it = requests.find(id);
+
+        if (it == requests.end()) {
             return false;
         }
         
-        requests.erase(id);
+        remove_request(it);
+        update_refresh_tick();
         return true;
     }
 
+    void obd2_bridge::acquire_request(const obd2_server::request &request) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+        auto it = requests.find(request.id);
+
+        if (it == requests.end()) {
+            add_request(request).leases++;
+            return;
+        }
+
+        it->second.leases++;
+    }
+
+    void obd2_bridge::release_request(const UUIDv4::UUID &id) {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+        auto it = requests.find(id);
+
+        if (it == requests.end() || it->second.leases == 0) {
+            return;
+        }
+
+        // Start the TTL from the release, so the request is not evicted right away
+        it->second.leases--;
+        values.touch(it->second.slot);
+    }
+
     void obd2_bridge::clear_requests() {
-        requests.clear();
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        while (!requests.empty()) {
+            remove_request(requests.begin());
+        }
+
+        update_refresh_tick();
     }
 
     bool obd2_bridge::request_registered(const UUIDv4::UUID &id) {
-        return requests.find(id) != requests.end();
+        size_t slot = get_request_slot(id);
+        return slot != INVALID_SLOT && values.get_registered(slot);
     }
 
     float obd2_bridge::get_request_val(const UUIDv4::UUID &id) {
-        if (requests.find(id) == requests.end()) {
+        size_t slot = get_request_slot(id);
+
+        if (slot == INVALID_SLOT) {
             return std::numeric_limits<float>::quiet_NaN();
         }
 
-        return requests[id].get_value();
+        return get_slot_val(slot);
+    }
+
+    value_sample obd2_bridge::get_request_sample(const UUIDv4::UUID &id) {
+        size_t slot = get_request_slot(id);
+
+        if (slot == INVALID_SLOT) {
+            return value_sample{ std::numeric_limits<float>::quiet_NaN(), std::chrono::system_clock::time_point(), true };
+        }
+
+        return get_slot_sample(slot);
+    }
+
+    std::vector<uint8_t> obd2_bridge::get_request_raw(const UUIDv4::UUID &id) {
+        size_t slot = get_request_slot(id);
+
+        if (slot == INVALID_SLOT) {
+            return std::vector<uint8_t>();
+        }
+
+        return get_slot_raw(slot);
     }
 
-    const std::vector<uint8_t> &obd2_bridge::get_request_raw(const UUIDv4::UUID &id) {
-        if (requests.find(id) == requests.end()) {
-            static const std::vector<uint8_t> empty;
-            return empty;
+    size_t obd2_bridge::get_request_slot(const UUIDv4::UUID &id) const {
+        auto slots = request_slots.load();
+        auto it = slots->find(id);
+
+        if (it == slots->end()) {
+            return INVALID_SLOT;
         }
 
-        return requests[id].get_raw();
+        return it->second;
+    }
+
+    float obd2_bridge::get_slot_val(size_t slot) {
+        values.touch(slot);
+        return values.read_value(slot);
+    }
+
+    value_sample obd2_bridge::get_slot_sample(size_t slot) {
+        values.touch(slot);
+        return values.read_sample(slot);
+    }
+
+    uint64_t obd2_bridge::get_slot_changed_epoch(size_t slot) {
+        values.touch(slot);
+        return values.read_changed_epoch(slot);
+    }
+
+    std::vector<uint8_t> obd2_bridge::get_slot_raw(size_t slot) {
+        values.touch(slot);
+        return values.read_raw(slot);
     }
 
     std::vector<UUIDv4::UUID> obd2_bridge::supported_requests(const std::vector<obd2_server::request> &requests) {
@@ -117,7 +246,7 @@ namespace obd2_server {
         }
 
         for (const auto &r : requests) {
-            if (instance.pid_supported(r.ecu, r.service, r.pid)) {
+            if (is_pid_supported(r.ecu, r.service, r.pid)) {
                 supported.push_back(r.id);
             }
         }
@@ -126,11 +255,29 @@ namespace obd2_server {
     }
 
     void obd2_bridge::await_new_data() {
-        while (!has_new_data) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(1));
-        }
+        await_new_data(get_refresh_epoch());
+    }
+
+    uint64_t obd2_bridge::await_new_data(uint64_t epoch) {
+        std::unique_lock<std::mutex> epoch_lock(refresh_epoch_mutex);
+
+        refresh_epoch_cv.wait(epoch_lock, [this, epoch] { return refresh_epoch > epoch; });
+
+        return refresh_epoch;
+    }
+
+    uint64_t obd2_bridge::await_new_data(uint64_t epoch, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> epoch_lock(refresh_epoch_mutex);
+
+        // Returns the unchanged epoch on timeout
+        refresh_epoch_cv.wait_for(epoch_lock, timeout, [this, epoch] { return refresh_epoch > epoch; });
+
+        return refresh_epoch;
+    }
 
-        has_new_data = false;
+    uint64_t obd2_bridge::get_refresh_epoch() {
+        std::lock_guard<std::mutex> epoch_lock(refresh_epoch_mutex);
+        return refresh_epoch;
     }
 
     std::unordered_map<std::string, std::vector<obd2::dtc>> obd2_bridge::get_dtcs() {
@@ -171,13 +318,21 @@ namespace obd2_server {
     }
 
     void obd2_bridge::set_can_refresh_ms(uint32_t refresh_ms) {
-        instance.set_refresh_ms(refresh_ms);
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        this->refresh_ms = refresh_ms;
+        update_refresh_tick();
+        poll_groups_dirty = true;
     }
 
     void obd2_bridge::set_bitrate_discovery(bool enable) {
         enable_bitrate_discovery = enable;
     }
     
+    void obd2_bridge::set_request_ttl_ms(uint32_t ttl_ms) {
+        request_ttl_ms = ttl_ms;
+    }
+    
     bool obd2_bridge::get_is_connected() const {
         return is_connected;
     }
@@ -187,18 +342,21 @@ namespace obd2_server {
     }
 
     uint32_t obd2_bridge::get_can_refresh_ms() const {
-        return instance.get_refresh_ms();
+        return refresh_ms;
     }
 
     bool obd2_bridge::get_bitrate_discovery() const {
         return enable_bitrate_discovery;
     }
 
+    uint32_t obd2_bridge::get_request_ttl_ms() const {
+        return request_ttl_ms;
+    }
+
     void obd2_bridge::set_next_bitrate() {
         size_t bitrate_index = 0;
-        size_t bitrate_count = sizeof(BITRATES) / sizeof(BITRATES[0]);
 
-        for (size_t i = 0; i < bitrate_count; i++) {
+        for (size_t i = 0; i < BITRATE_COUNT; i++) {
             bitrate_index++;
 
             if (BITRATES[i] == can_bitrate) {
@@ -206,12 +364,140 @@ namespace obd2_server {
             }
         }
 
-        bitrate_index = bitrate_index % bitrate_count;
+        bitrate_index = bitrate_index % BITRATE_COUNT;
         set_can_bitrate(BITRATES[bitrate_index]);
     }
 
+    obd2_bridge::scheduled_request &obd2_bridge::add_request(const obd2_server::request &request) {
+        size_t slot = assign_slot(request.id);
+        auto &sr = requests.try_emplace(request.id, request, instance, slot).first->second;
+
+        // Changes below a fraction of the request's range do not count for delta responses
+        float range = request.max - request.min;
+        values.set_deadband(slot, std::isfinite(range) && range > 0 ? range * DEADBAND_FRACTION : 0.0f);
+
+        values.touch(slot);
+        values.set_registered(slot, true);
+        update_refresh_tick();
+        poll_groups_dirty = true;
+
+        return sr;
+    }
+
+    void obd2_bridge::remove_request(std::unordered_map<UUIDv4::UUID, scheduled_request>::iterator it) {
+        size_t slot = it->second.slot;
+
+        values.set_registered(slot, false);
+        values.clear(slot);
+        requests.erase(it);
+        poll_groups_dirty = true;
+    }
+
+    size_t obd2_bridge::assign_slot(const UUIDv4::UUID &id) {
+        auto slots = request_slots.load();
+        auto it = slots->find(id);
+
+        // Slots stay assigned to their request for the lifetime of the bridge
+        if (it != slots->end()) {
+            return it->second;
+        }
+
+        if (slots->size() >= values.get_capacity()) {
+            throw std::runtime_error("No free value slot for request [" + id.str() + "]");
+        }
+
+        // Publish a new slot map, readers still holding the old one are not affected
+        auto new_slots = std::make_shared<std::unordered_map<UUIDv4::UUID, size_t>>(*slots);
+        size_t slot = new_slots->size();
+
+        new_slots->try_emplace(id, slot);
+        request_slots.store(new_slots);
+
+        return slot;
+    }
+
+    void obd2_bridge::evict_idle_requests() {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        const auto now = std::chrono::steady_clock::now();
+        const auto ttl = std::chrono::milliseconds(request_ttl_ms);
+        bool evicted = false;
+
+        for (auto it = requests.begin(); it != requests.end();) {
+            if (it->second.leases == 0 && now - values.get_last_read(it->second.slot) > ttl) {
+                remove_request(it++);
+                evicted = true;
+            }
+            else {
+                it++;
+            }
+        }
+
+        if (evicted) {
+            update_refresh_tick();
+        }
+    }
+
+    void obd2_bridge::record_response(uint32_t ecu, const uint8_t *payload, size_t size, 
+        std::chrono::system_clock::time_point rx_time) {
+        // Negative responses (7F) do not carry a value
+        if (size < 1 || payload[0] < 0x40 || payload[0] == 0x7F) {
+            return;
+        }
+
+        uint8_t service = payload[0] - 0x40;
+        uint32_t pid = 0;
+
+        if (service == 0x22 && size >= 3) {
+            pid = (payload[1] << 8) | payload[2];
+        }
+        else if (service != 0x22 && size >= 2) {
+            pid = payload[1];
+        }
+
+        std::lock_guard<std::mutex> rx_times_lock(rx_times_mutex);
+
+        // Only the first PID of a chained response can be located without knowing the PID lengths, 
+        // the others are matched through the ECU's last response to the service
+        rx_times[get_pid_key(ecu, service, pid)] = rx_time;
+        rx_times[get_pid_key(ecu, service, ANY_PID)] = rx_time;
+    }
+
+    std::chrono::system_clock::time_point obd2_bridge::get_response_time(const scheduled_request &r, 
+        std::chrono::system_clock::time_point now) {
+        // Without the capture socket the best guess is the end of the cycle
+        if (!is_capturing) {
+            return now;
+        }
+
+        std::lock_guard<std::mutex> rx_times_lock(rx_times_mutex);
+
+        for (uint32_t pid : { static_cast<uint32_t>(r.pid), ANY_PID }) {
+            auto it = rx_times.find(get_pid_key(r.ecu, r.service, pid));
+
+            if (it != rx_times.end() && it->second >= last_publish) {
+                return it->second;
+            }
+        }
+
+        // The ECU did not answer in this cycle, so the value keeps its age
+        return values.read_sample(r.slot).timestamp;
+    }
+
+    uint64_t obd2_bridge::get_pid_key(uint32_t ecu, uint8_t service, uint32_t pid) {
+        return (static_cast<uint64_t>(ecu) << 32) | (static_cast<uint64_t>(service) << 24) | pid;
+    }
+
     void obd2_bridge::handle_obd2_refreshed() {
-        has_new_data = true;
+        schedule_requests();
+
+        // Wake up every waiter, not just the first one to notice
+        {
+            std::lock_guard<std::mutex> epoch_lock(refresh_epoch_mutex);
+            refresh_epoch++;
+        }
+
+        refresh_epoch_cv.notify_all();
         
         std::lock_guard<std::mutex> refreshed_cb_lock(refreshed_cb_mutex);
 
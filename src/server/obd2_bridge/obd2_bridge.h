@@ -1,16 +1,23 @@
 #pragma once
 
 #include <atomic>
+#include <bitset>
+#include <condition_variable>
+#include <memory>
 #include <obd2.h>
 #include <unordered_map>
+#include <unordered_set>
 #include <uuid_v4.h>
 #include <vector>
 
 #include "../vehicle/vehicle.h"
+#include "value_table/value_table.h"
 
 namespace obd2_server {
     class obd2_bridge {
         public:
+            static const size_t INVALID_SLOT;
+
             obd2_bridge();
             obd2_bridge(const std::string &device, bool skip_can_setup, bool enable_bitrate_discovery, 
                 uint32_t bitrate, uint32_t refresh_ms = 1000, bool enable_pid_chaining = false);
@@ -25,13 +32,24 @@ namespace obd2_server {
 
             bool register_request(const obd2_server::request &request);
             bool unregister_request(const UUIDv4::UUID &id);
+            void acquire_request(const obd2_server::request &request);
+            void release_request(const UUIDv4::UUID &id);
             void clear_requests();
             bool request_registered(const UUIDv4::UUID &id);
             float get_request_val(const UUIDv4::UUID &id);
-            const std::vector<uint8_t> &get_request_raw(const UUIDv4::UUID &id);
+            std::vector<uint8_t> get_request_raw(const UUIDv4::UUID &id);
+            size_t get_request_slot(const UUIDv4::UUID &id) const;
+            value_sample get_request_sample(const UUIDv4::UUID &id);
+            float get_slot_val(size_t slot);
+            value_sample get_slot_sample(size_t slot);
+            uint64_t get_slot_changed_epoch(size_t slot); // Refresh epoch that last changed the value beyond its deadband
+            std::vector<uint8_t> get_slot_raw(size_t slot);
             std::vector<UUIDv4::UUID> supported_requests(const std::vector<obd2_server::request> &requests);
 
             void await_new_data();
+            uint64_t await_new_data(uint64_t epoch);
+            uint64_t await_new_data(uint64_t epoch, std::chrono::milliseconds timeout);
+            uint64_t get_refresh_epoch();
 
             std::unordered_map<std::string, std::vector<obd2::dtc>> get_dtcs(); // ECU name => DTCs
             void clear_dtcs();
@@ -40,32 +58,143 @@ namespace obd2_server {
             void set_can_bitrate(uint32_t bitrate);
             void set_can_refresh_ms(uint32_t refresh_ms);
             void set_bitrate_discovery(bool enable);
+            void set_request_ttl_ms(uint32_t ttl_ms);
+            void set_support_cache_dir(const std::string &path);
 
             bool get_is_connected() const;
             bool get_bitrate_discovery() const;
             uint32_t get_can_bitrate() const;
             uint32_t get_can_refresh_ms() const;
+            uint32_t get_request_ttl_ms() const;
+            std::string get_vin();
 
         private:
+            // A registered request together with its position in the refresh schedule
+            struct scheduled_request {
+                obd2::request instance;
+                size_t slot;
+                uint32_t ecu;
+                uint8_t service;
+                uint16_t pid;
+                uint32_t refresh_ms; // 0 => use the bridge's refresh_ms
+                bool polling;
+
+                // Requests without leases are evicted once their slot has not been read for request_ttl
+                uint32_t leases;
+
+                scheduled_request(const obd2_server::request &request, obd2::obd2 &instance, size_t slot);
+            };
+
+            // Requests that are resumed and stopped together, so the obd2 instance 
+            // can chain their PIDs into one multi-PID request
+            struct poll_group {
+                uint32_t ecu;
+                std::vector<UUIDv4::UUID> members;
+                uint32_t refresh_ms;
+                std::chrono::steady_clock::time_point deadline;
+                bool polling = false;
+                bool chained = false;       // More than one distinct PID
+                bool serialized = false;    // ECU rejected chaining, at most one of its groups is polled per cycle
+                uint32_t unanswered_cycles = 0;
+            };
+
+            // PIDs of the services with J1979 support bitmaps, for one ECU
+            struct pid_support {
+                std::bitset<256> service_01;
+                std::bitset<256> service_09;
+            };
+
             static const std::chrono::milliseconds CONNECTION_CHECK_INTERVAL;
+            static const std::chrono::milliseconds CONNECTION_RETRY_INTERVAL;
+            static const std::chrono::milliseconds DISCOVERY_WINDOW;
             static const uint32_t BITRATES[];
+            static const size_t BITRATE_COUNT;
+            static const uint32_t MIN_REFRESH_MS;
+            static const size_t MAX_SLOTS;
+            static const size_t MAX_CHAINED_PIDS;
+            static const uint32_t CHAINING_FALLBACK_CYCLES;
+            static const uint32_t STALE_REFRESH_CYCLES;
+            static const uint32_t ANY_PID;
+            static const float DEADBAND_FRACTION;
+            static const std::chrono::milliseconds VIN_READ_TIMEOUT;
 
             obd2::obd2 instance;
-            std::unordered_map<UUIDv4::UUID, obd2::request> requests;
+
+            // Writers (registration, eviction and publishing after a refresh) hold requests_mutex, 
+            // readers only go through request_slots and values
+            std::mutex requests_mutex;
+            std::unordered_map<UUIDv4::UUID, scheduled_request> requests;
+            std::atomic<std::shared_ptr<const std::unordered_map<UUIDv4::UUID, size_t>>> request_slots;
+            value_table values;
+
+            // Only touched with requests_mutex held
+            std::vector<poll_group> poll_groups;
+            std::unordered_set<uint32_t> unchained_ecus;
+            bool poll_groups_dirty = true;
+
+            std::atomic<uint32_t> refresh_ms = 1000;
+            std::atomic<uint32_t> request_ttl_ms = 30000;
+            uint32_t tick_ms = 1000;
             uint32_t can_bitrate;
             std::string can_device;
             bool skip_can_setup;
             bool enable_bitrate_discovery;
+            bool enable_pid_chaining;
 
             std::thread connection_thread;
             std::atomic<bool> connection_thread_running = false;
             std::atomic<bool> is_connected = false;
-            std::atomic<bool> has_new_data = false;
+
+            // Incremented after every refresh cycle, waiters block until it passes their epoch
+            std::mutex refresh_epoch_mutex;
+            std::condition_variable refresh_epoch_cv;
+            uint64_t refresh_epoch = 0;
 
             std::mutex refreshed_cb_mutex;
             std::function<void()> refreshed_cb;
 
+            // Kernel receive times of the last response per (ECU, service, PID), 
+            // recorded by the capture thread from a passive socket on the CAN device
+            std::mutex rx_times_mutex;
+            std::unordered_map<uint64_t, std::chrono::system_clock::time_point> rx_times;
+            std::chrono::system_clock::time_point last_publish;
+
+            // Built once per connection and persisted per VIN. PIDs of services 
+            // without support bitmaps are asked for once per connection and remembered
+            std::mutex support_mutex;
+            std::unordered_map<uint32_t, pid_support> supported_pids; // ECU => Supported PIDs
+            std::unordered_map<uint64_t, bool> probed_pids;
+            std::string support_cache_dir;
+            std::string vin;
+            bool support_loaded = false;
+
+            std::thread capture_thread;
+            std::atomic<bool> capture_thread_running = false;
+            std::atomic<bool> is_capturing = false;
+
             void set_next_bitrate();
+            uint32_t discover_bitrate();
+            scheduled_request &add_request(const obd2_server::request &request);
+            void remove_request(std::unordered_map<UUIDv4::UUID, scheduled_request>::iterator it);
+            size_t assign_slot(const UUIDv4::UUID &id);
+            void schedule_requests();
+            void plan_poll_groups();
+            void check_chained_response(poll_group &group, std::chrono::system_clock::time_point since);
+            bool answered_since(scheduled_request &r, std::chrono::system_clock::time_point since);
+            void set_request_polling(scheduled_request &r, bool polling);
+            void evict_idle_requests();
+            void update_refresh_tick();
+            uint32_t get_request_refresh_ms(const scheduled_request &r) const;
+            void capture_loop();
+            void record_response(uint32_t ecu, const uint8_t *payload, size_t size, 
+                std::chrono::system_clock::time_point rx_time);
+            std::chrono::system_clock::time_point get_response_time(const scheduled_request &r, 
+                std::chrono::system_clock::time_point now);
+            static uint64_t get_pid_key(uint32_t ecu, uint8_t service, uint32_t pid);
+            void load_pid_support();
+            void reset_pid_support();
+            bool is_pid_supported(uint32_t ecu, uint8_t service, uint16_t pid);
+            std::string read_vin();
             void setup_can_device();
             void shutdown_can_device();
             void handle_obd2_refreshed();
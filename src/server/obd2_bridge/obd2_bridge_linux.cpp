@@ -1,35 +1,82 @@
 #include "obd2_bridge.h"
 
+#include <cstring>
 #include <iostream>
-#include <fstream>
+#include <linux/can.h>
+#include <linux/can/error.h>
+#include <linux/can/netlink.h>
+#include <linux/can/raw.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <linux/if_link.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
 
 namespace obd2_server {
-    int32_t execute_command(std::string command, std::string &output);
+    // Minimal rtnetlink client for configuring the CAN interface without shelling out to iproute2
+    class rtnetlink {
+        public:
+            rtnetlink();
+            rtnetlink(const rtnetlink &r) = delete;
+            rtnetlink(rtnetlink &&r) = delete;
+            ~rtnetlink();
+
+            rtnetlink &operator=(const rtnetlink &r) = delete;
+            rtnetlink &operator=(rtnetlink &&r) = delete;
+
+            std::string get_link_kind(int32_t ifindex);
+            uint32_t get_can_ctrlmode_supported(int32_t ifindex); // All bits set if the kernel does not report them
+            void set_link(int32_t ifindex, bool up, uint32_t can_bitrate = 0, uint32_t can_ctrlmode_flags = 0);
+            bool await_link_state(int32_t ifindex, bool up, std::chrono::milliseconds timeout);
+
+        private:
+            static const size_t BUFFER_SIZE = 8192;
+            static const size_t REQUEST_SIZE = 512;
+
+            int fd = -1;
+            uint32_t seq = 0;
+
+            void transact(nlmsghdr *request, const std::function<void(const nlmsghdr *)> &on_reply);
+            bool link_state_matches(const nlmsghdr *msg, int32_t ifindex, bool up) const;
+            void get_link_info(int32_t ifindex, const std::function<void(const rtattr *)> &on_info_attr);
+
+            static rtattr *add_attr(nlmsghdr *msg, uint16_t type, const void *data, size_t len);
+            static rtattr *begin_nested_attr(nlmsghdr *msg, uint16_t type);
+            static void end_nested_attr(nlmsghdr *msg, rtattr *nested);
+    };
+
+    const std::chrono::milliseconds LINK_STATE_TIMEOUT = std::chrono::milliseconds(2000);
+    const std::chrono::milliseconds CAPTURE_POLL_INTERVAL = std::chrono::milliseconds(200);
+
+    int32_t get_ifindex(const std::string &device);
+    void count_can_frames(int32_t ifindex, std::chrono::milliseconds window, size_t &valid, size_t &errors);
+    int open_capture_socket(int32_t ifindex);
+    uint32_t get_response_ecu(canid_t can_id);
 
     void obd2_bridge::setup_can_device() {
         if (skip_can_setup) {
             return;
         }
 
-        // Before setting up can device, shut it down first, to change attributes
-        shutdown_can_device();
+        int32_t ifindex = get_ifindex(can_device);
+        rtnetlink nl;
 
-        // Wait for the device to be shut down
-        std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        // The bitrate can only be changed while the device is down
+        nl.set_link(ifindex, false);
 
-        // Make sure the can device string is safe to use as a shell parameter
-        for (char c : can_device) {
-            if (!isalnum(c)) {
-                throw std::invalid_argument("Could not setup CAN device: Invalid device name");
-            }
+        // Virtual devices (vcan) have no bit timing, only bring them up
+        if (nl.get_link_kind(ifindex) == "can") {
+            nl.set_link(ifindex, true, can_bitrate);
+        }
+        else {
+            nl.set_link(ifindex, true);
         }
 
-        std::string command = "ip link set " + can_device + " up type can bitrate " 
-            + std::to_string(can_bitrate) + " loopback off";
-        std::string output;
-
-        if (execute_command(command, output) != 0) {
-            throw std::runtime_error("Could not set up CAN device: " + output);
+        if (!nl.await_link_state(ifindex, true, LINK_STATE_TIMEOUT)) {
+            throw std::runtime_error("Could not set up CAN device: Device did not come up");
         }
     }
 
@@ -38,38 +85,565 @@ namespace obd2_server {
             return;
         }
 
-        // Make sure the can device string is safe to use as a shell parameter
-        for (char c : can_device) {
-            if (!isalnum(c)) {
-                    throw std::invalid_argument("Could not shutdown CAN device: Invalid device name");
+        int32_t ifindex = get_ifindex(can_device);
+        rtnetlink nl;
+
+        nl.set_link(ifindex, false);
+
+        if (!nl.await_link_state(ifindex, false, LINK_STATE_TIMEOUT)) {
+            throw std::runtime_error("Could not shut down CAN device: Device did not go down");
+        }
+    }
+
+    uint32_t obd2_bridge::discover_bitrate() {
+        if (skip_can_setup) {
+            return 0;
+        }
+
+        int32_t ifindex = get_ifindex(can_device);
+        rtnetlink nl;
+
+        // Virtual devices accept frames at any bitrate
+        if (nl.get_link_kind(ifindex) != "can") {
+            return 0;
+        }
+
+        // Controllers without listen-only mode (e.g. mcp251x) can only be probed actively by the caller, 
+        // bus error reporting only makes wrong bitrates show up sooner
+        uint32_t supported = nl.get_can_ctrlmode_supported(ifindex);
+        uint32_t ctrlmode = CAN_CTRLMODE_LISTENONLY | (supported & CAN_CTRLMODE_BERR_REPORTING);
+
+        if (!(supported & CAN_CTRLMODE_LISTENONLY)) {
+            return 0;
+        }
+
+        // Listen at each candidate bitrate without ever acknowledging or transmitting. 
+        // At the wrong bitrate the controller only sees bus errors, at the right one valid frames
+        for (size_t i = 0; i < BITRATE_COUNT; i++) {
+            uint32_t bitrate = BITRATES[i];
+            size_t valid = 0;
+            size_t errors = 0;
+
+            nl.set_link(ifindex, false);
+
+            try {
+                nl.set_link(ifindex, true, bitrate, ctrlmode);
+            }
+            catch (const std::system_error &e) {
+                if (e.code() != std::errc::operation_not_supported) {
+                    throw;
+                }
+
+                // Kernels that do not report the supported modes only tell on the first attempt
+                if (!(ctrlmode & CAN_CTRLMODE_BERR_REPORTING)) {
+                    return 0;
+                }
+
+                ctrlmode &= ~CAN_CTRLMODE_BERR_REPORTING;
+                i--;
+                continue;
+            }
+
+            if (!nl.await_link_state(ifindex, true, LINK_STATE_TIMEOUT)) {
+                continue;
+            }
+
+            count_can_frames(ifindex, DISCOVERY_WINDOW, valid, errors);
+
+            if (valid > 0 && errors == 0) {
+                return bitrate;
+            }
+        }
+
+        return 0;
+    }
+
+    void count_can_frames(int32_t ifindex, std::chrono::milliseconds window, size_t &valid, size_t &errors) {
+        int fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+
+        if (fd < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()), "Could not open CAN socket");
+        }
+
+        can_err_mask_t err_mask = CAN_ERR_MASK;
+        sockaddr_can addr = { };
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = ifindex;
+
+        if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_ERR_FILTER, &err_mask, sizeof(err_mask)) < 0
+            || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            int err = errno;
+            close(fd);
+            throw std::system_error(std::error_code(err, std::generic_category()), "Could not set up CAN socket");
+        }
+
+        const auto end = std::chrono::steady_clock::now() + window;
+        can_frame frame;
+
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now());
+
+            if (remaining.count() <= 0) {
+                break;
+            }
+
+            pollfd pfd = { fd, POLLIN, 0 };
+
+            if (poll(&pfd, 1, remaining.count()) <= 0) {
+                continue;
+            }
+
+            if (read(fd, &frame, sizeof(frame)) != sizeof(frame)) {
+                continue;
+            }
+
+            if (frame.can_id & CAN_ERR_FLAG) {
+                errors++;
+            }
+            else {
+                valid++;
+            }
+        }
+
+        close(fd);
+    }
+
+    void obd2_bridge::capture_loop() {
+        // Multi-frame responses in flight per ECU, only their header and remaining length are kept
+        struct pending_response {
+            uint8_t header[6];
+            size_t header_size;
+            int32_t remaining;
+        };
+
+        std::unordered_map<uint32_t, pending_response> pending;
+        int fd = -1;
+
+        while (capture_thread_running) {
+            if (fd < 0) {
+                try {
+                    fd = open_capture_socket(get_ifindex(can_device));
+                    is_capturing = true;
+                }
+                catch (const std::exception &e) {
+                    std::this_thread::sleep_for(CONNECTION_RETRY_INTERVAL);
+                    continue;
+                }
+            }
+
+            pollfd pfd = { fd, POLLIN, 0 };
+
+            if (poll(&pfd, 1, CAPTURE_POLL_INTERVAL.count()) <= 0) {
+                continue;
+            }
+
+            can_frame frame;
+            char control[CMSG_SPACE(sizeof(scm_timestamping))];
+            iovec iov = { &frame, sizeof(frame) };
+            msghdr msg = { };
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+
+            ssize_t len = recvmsg(fd, &msg, 0);
+
+            // The socket survives the device going down for a bitrate change, other errors reopen it
+            if (len < 0) {
+                if (errno != ENETDOWN && errno != EINTR) {
+                    close(fd);
+                    fd = -1;
+                    is_capturing = false;
+                }
+
+                continue;
+            }
+
+            if (len != sizeof(frame) || frame.len == 0) {
+                continue;
+            }
+
+            auto rx_time = std::chrono::system_clock::now();
+
+            for (cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_TIMESTAMPING) {
+                    continue;
+                }
+
+                // ts[0] holds the software receive time on the system clock
+                scm_timestamping ts;
+                std::memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+
+                rx_time = std::chrono::system_clock::time_point(std::chrono::duration_cast<std::chrono::system_clock::duration>(
+                    std::chrono::seconds(ts.ts[0].tv_sec) + std::chrono::nanoseconds(ts.ts[0].tv_nsec)));
+            }
+
+            // Follow the ISO-TP framing far enough to know when a response is complete
+            uint32_t ecu = get_response_ecu(frame.can_id);
+            uint8_t frame_type = frame.data[0] >> 4;
+
+            if (frame_type == 0) {
+                size_t size = std::min<size_t>(frame.data[0] & 0x0F, frame.len - 1);
+                record_response(ecu, frame.data + 1, size, rx_time);
+            }
+            else if (frame_type == 1 && frame.len == CAN_MAX_DLEN) {
+                pending_response &p = pending[ecu];
+
+                std::memcpy(p.header, frame.data + 2, sizeof(p.header));
+                p.header_size = sizeof(p.header);
+                p.remaining = (((frame.data[0] & 0x0F) << 8) | frame.data[1]) - sizeof(p.header);
+            }
+            else if (frame_type == 2) {
+                auto it = pending.find(ecu);
+
+                if (it == pending.end()) {
+                    continue;
+                }
+
+                it->second.remaining -= frame.len - 1;
+
+                if (it->second.remaining <= 0) {
+                    record_response(ecu, it->second.header, it->second.header_size, rx_time);
+                    pending.erase(it);
+                }
+            }
+        }
+
+        if (fd >= 0) {
+            close(fd);
+        }
+
+        is_capturing = false;
+    }
+
+    int open_capture_socket(int32_t ifindex) {
+        int fd = socket(PF_CAN, SOCK_RAW | SOCK_CLOEXEC, CAN_RAW);
+
+        if (fd < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()), "Could not open CAN socket");
+        }
+
+        // Only physical responses: 7E8-7EF and 18DAF1xx
+        can_filter filters[2];
+        filters[0].can_id = 0x7E8;
+        filters[0].can_mask = 0x7F8 | CAN_EFF_FLAG | CAN_RTR_FLAG;
+        filters[1].can_id = 0x18DAF100 | CAN_EFF_FLAG;
+        filters[1].can_mask = 0x1FFFFF00 | CAN_EFF_FLAG | CAN_RTR_FLAG;
+
+        // Software timestamps are taken by the kernel on reception, in the system clock's time base
+        int timestamping = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE;
+        sockaddr_can addr = { };
+        addr.can_family = AF_CAN;
+        addr.can_ifindex = ifindex;
+
+        if (setsockopt(fd, SOL_CAN_RAW, CAN_RAW_FILTER, filters, sizeof(filters)) < 0
+            || setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &timestamping, sizeof(timestamping)) < 0
+            || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            int err = errno;
+            close(fd);
+            throw std::system_error(std::error_code(err, std::generic_category()), "Could not set up CAN socket");
+        }
+
+        return fd;
+    }
+
+    uint32_t get_response_ecu(canid_t can_id) {
+        // Extended responses swap target and source address of the request
+        if (can_id & CAN_EFF_FLAG) {
+            uint32_t id = can_id & CAN_EFF_MASK;
+            return (id & 0x1FFF0000) | ((id & 0xFF) << 8) | ((id >> 8) & 0xFF);
+        }
+
+        // Standard responses are sent on the request ID + 8
+        return (can_id & CAN_SFF_MASK) - 8;
+    }
+
+    int32_t get_ifindex(const std::string &device) {
+        int32_t ifindex = if_nametoindex(device.c_str());
+
+        if (ifindex == 0) {
+            throw std::invalid_argument("Invalid CAN device " + device + ": " + std::strerror(errno));
+        }
+
+        return ifindex;
+    }
+
+    rtnetlink::rtnetlink() {
+        fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+        if (fd < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()), "Could not open netlink socket");
+        }
+
+        // Subscribe to link notifications, so state changes can be awaited instead of slept on
+        sockaddr_nl addr = { };
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = RTMGRP_LINK;
+
+        if (bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) < 0) {
+            int err = errno;
+            close(fd);
+            throw std::system_error(std::error_code(err, std::generic_category()), "Could not bind netlink socket");
+        }
+    }
+
+    rtnetlink::~rtnetlink() {
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    std::string rtnetlink::get_link_kind(int32_t ifindex) {
+        std::string kind;
+
+        get_link_info(ifindex, [&kind](const rtattr *info_attr) {
+            if (info_attr->rta_type == IFLA_INFO_KIND) {
+                kind = reinterpret_cast<const char *>(RTA_DATA(info_attr));
+            }
+        });
+
+        return kind;
+    }
+
+    uint32_t rtnetlink::get_can_ctrlmode_supported(int32_t ifindex) {
+        uint32_t supported = UINT32_MAX;
+
+        // IFLA_INFO_DATA => IFLA_CAN_CTRLMODE_EXT => IFLA_CAN_CTRLMODE_SUPPORTED, only sent since Linux 5.16
+        get_link_info(ifindex, [&supported](const rtattr *info_attr) {
+            if (info_attr->rta_type != IFLA_INFO_DATA) {
+                return;
+            }
+
+            int32_t data_len = RTA_PAYLOAD(info_attr);
+
+            for (const rtattr *data_attr = reinterpret_cast<const rtattr *>(RTA_DATA(info_attr));
+                RTA_OK(data_attr, data_len); data_attr = RTA_NEXT(data_attr, data_len)) {
+                if (data_attr->rta_type != IFLA_CAN_CTRLMODE_EXT) {
+                    continue;
+                }
+
+                int32_t ext_len = RTA_PAYLOAD(data_attr);
+
+                for (const rtattr *ext_attr = reinterpret_cast<const rtattr *>(RTA_DATA(data_attr));
+                    RTA_OK(ext_attr, ext_len); ext_attr = RTA_NEXT(ext_attr, ext_len)) {
+                    if (ext_attr->rta_type == IFLA_CAN_CTRLMODE_SUPPORTED && RTA_PAYLOAD(ext_attr) >= sizeof(uint32_t)) {
+                        std::memcpy(&supported, RTA_DATA(ext_attr), sizeof(uint32_t));
+                    }
                 }
+            }
+        });
+
+        return supported;
+    }
+
+    void rtnetlink::get_link_info(int32_t ifindex, const std::function<void(const rtattr *)> &on_info_attr) {
+        alignas(nlmsghdr) char buffer[REQUEST_SIZE] = { };
+        nlmsghdr *request = reinterpret_cast<nlmsghdr *>(buffer);
+        ifinfomsg *info = reinterpret_cast<ifinfomsg *>(NLMSG_DATA(request));
+
+        request->nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+        request->nlmsg_type = RTM_GETLINK;
+        request->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+        info->ifi_family = AF_UNSPEC;
+        info->ifi_index = ifindex;
+
+        transact(request, [&on_info_attr, ifindex](const nlmsghdr *msg) {
+            if (msg->nlmsg_type != RTM_NEWLINK) {
+                return;
+            }
+
+            const ifinfomsg *reply = reinterpret_cast<const ifinfomsg *>(NLMSG_DATA(msg));
+
+            if (reply->ifi_index != ifindex) {
+                return;
+            }
+
+            int32_t len = IFLA_PAYLOAD(msg);
+
+            for (const rtattr *attr = IFLA_RTA(reply); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+                if (attr->rta_type != IFLA_LINKINFO) {
+                    continue;
+                }
+
+                int32_t info_len = RTA_PAYLOAD(attr);
+
+                for (const rtattr *info_attr = reinterpret_cast<const rtattr *>(RTA_DATA(attr));
+                    RTA_OK(info_attr, info_len); info_attr = RTA_NEXT(info_attr, info_len)) {
+                    on_info_attr(info_attr);
+                }
+            }
+        });
+    }
+
+    void rtnetlink::set_link(int32_t ifindex, bool up, uint32_t can_bitrate, uint32_t can_ctrlmode_flags) {
+        alignas(nlmsghdr) char buffer[REQUEST_SIZE] = { };
+        nlmsghdr *request = reinterpret_cast<nlmsghdr *>(buffer);
+        ifinfomsg *info = reinterpret_cast<ifinfomsg *>(NLMSG_DATA(request));
+
+        request->nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+        request->nlmsg_type = RTM_NEWLINK;
+        request->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+        info->ifi_family = AF_UNSPEC;
+        info->ifi_index = ifindex;
+        info->ifi_flags = up ? IFF_UP : 0;
+        info->ifi_change = IFF_UP;
+
+        // Same as "type can bitrate <bitrate> loopback off [listen-only on] [berr-reporting on]"
+        if (can_bitrate != 0) {
+            can_bittiming bittiming = { };
+            can_ctrlmode ctrlmode = { };
+
+            bittiming.bitrate = can_bitrate;
+            // Only modes that are switched on need controller support, the others stay off
+            ctrlmode.mask = CAN_CTRLMODE_LOOPBACK | CAN_CTRLMODE_LISTENONLY | CAN_CTRLMODE_BERR_REPORTING;
+            ctrlmode.flags = can_ctrlmode_flags & ctrlmode.mask;
+
+            rtattr *linkinfo = begin_nested_attr(request, IFLA_LINKINFO);
+            add_attr(request, IFLA_INFO_KIND, "can", std::strlen("can"));
+
+            rtattr *data = begin_nested_attr(request, IFLA_INFO_DATA);
+            add_attr(request, IFLA_CAN_BITTIMING, &bittiming, sizeof(bittiming));
+            add_attr(request, IFLA_CAN_CTRLMODE, &ctrlmode, sizeof(ctrlmode));
+            end_nested_attr(request, data);
+
+            end_nested_attr(request, linkinfo);
         }
 
-        std::string command = "ip link set " + can_device + " down";
-        std::string output;
+        transact(request, nullptr);
+    }
+
+    bool rtnetlink::await_link_state(int32_t ifindex, bool up, std::chrono::milliseconds timeout) {
+        alignas(nlmsghdr) char request_buffer[REQUEST_SIZE] = { };
+        nlmsghdr *request = reinterpret_cast<nlmsghdr *>(request_buffer);
+        ifinfomsg *info = reinterpret_cast<ifinfomsg *>(NLMSG_DATA(request));
+        bool matches = false;
+
+        // Check the current state first, the notification may already have been sent
+        request->nlmsg_len = NLMSG_LENGTH(sizeof(ifinfomsg));
+        request->nlmsg_type = RTM_GETLINK;
+        request->nlmsg_flags = NLM_F_REQUEST | NLM_F_ACK;
+        info->ifi_family = AF_UNSPEC;
+        info->ifi_index = ifindex;
+
+        transact(request, [this, &matches, ifindex, up](const nlmsghdr *msg) {
+            matches = matches || link_state_matches(msg, ifindex, up);
+        });
+
+        const auto end = std::chrono::steady_clock::now() + timeout;
+        alignas(nlmsghdr) char buffer[BUFFER_SIZE];
+
+        // Then wait for link notifications until the state matches
+        while (!matches) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(end - std::chrono::steady_clock::now());
+
+            if (remaining.count() <= 0) {
+                return false;
+            }
 
-        if (execute_command(command, output) != 0) {
-            throw std::runtime_error("Could not shut down CAN device: " + output);
+            pollfd pfd = { fd, POLLIN, 0 };
+
+            if (poll(&pfd, 1, remaining.count()) <= 0) {
+                continue;
+            }
+
+            ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
+
+            if (len < 0) {
+                throw std::system_error(std::error_code(errno, std::generic_category()), "Could not read netlink socket");
+            }
+
+            for (const nlmsghdr *msg = reinterpret_cast<const nlmsghdr *>(buffer);
+                NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+                matches = matches || link_state_matches(msg, ifindex, up);
+            }
         }
+
+        return true;
     }
 
-    int32_t execute_command(std::string command, std::string &output) {
-        uint32_t timestamp = std::chrono::duration_cast<std::chrono::milliseconds>(
-            std::chrono::system_clock::now().time_since_epoch()).count();
+    void rtnetlink::transact(nlmsghdr *request, const std::function<void(const nlmsghdr *)> &on_reply) {
+        sockaddr_nl kernel = { };
+        kernel.nl_family = AF_NETLINK;
+
+        request->nlmsg_seq = ++seq;
+
+        if (sendto(fd, request, request->nlmsg_len, 0, reinterpret_cast<sockaddr *>(&kernel), sizeof(kernel)) < 0) {
+            throw std::system_error(std::error_code(errno, std::generic_category()), "Could not send netlink request");
+        }
+
+        alignas(nlmsghdr) char buffer[BUFFER_SIZE];
 
-        std::string tmp_file = std::filesystem::temp_directory_path().string() 
-            + "/obd2_tmp_" + std::to_string(timestamp);
+        // Read until the kernel acknowledges the request, notifications may arrive in between
+        while (true) {
+            ssize_t len = recv(fd, buffer, sizeof(buffer), 0);
 
-        command += " > " + tmp_file + " 2>&1";
+            if (len < 0) {
+                throw std::system_error(std::error_code(errno, std::generic_category()), "Could not read netlink socket");
+            }
 
-        int32_t ret = system(command.c_str());
+            for (const nlmsghdr *msg = reinterpret_cast<const nlmsghdr *>(buffer);
+                NLMSG_OK(msg, len); msg = NLMSG_NEXT(msg, len)) {
+                if (msg->nlmsg_type == NLMSG_ERROR && msg->nlmsg_seq == seq) {
+                    const nlmsgerr *err = reinterpret_cast<const nlmsgerr *>(NLMSG_DATA(msg));
 
-        std::ifstream file(tmp_file);
-        std::stringstream buffer;
-        buffer << file.rdbuf();
+                    if (err->error != 0) {
+                        throw std::system_error(std::error_code(-err->error, std::generic_category()), "Netlink request failed");
+                    }
 
-        output = buffer.str();
+                    return;
+                }
+
+                if (on_reply) {
+                    on_reply(msg);
+                }
+            }
+        }
+    }
+
+    bool rtnetlink::link_state_matches(const nlmsghdr *msg, int32_t ifindex, bool up) const {
+        if (msg->nlmsg_type != RTM_NEWLINK) {
+            return false;
+        }
+
+        const ifinfomsg *info = reinterpret_cast<const ifinfomsg *>(NLMSG_DATA(msg));
+
+        if (info->ifi_index != ifindex) {
+            return false;
+        }
+
+        // A device that is up is only usable once the controller reports it as running
+        if (up) {
+            return (info->ifi_flags & IFF_UP) && (info->ifi_flags & IFF_RUNNING);
+        }
+
+        return !(info->ifi_flags & IFF_UP);
+    }
+
+    rtattr *rtnetlink::add_attr(nlmsghdr *msg, uint16_t type, const void *data, size_t len) {
+        size_t attr_len = RTA_LENGTH(len);
+
+        if (NLMSG_ALIGN(msg->nlmsg_len) + RTA_ALIGN(attr_len) > REQUEST_SIZE) {
+            throw std::length_error("Netlink request too large");
+        }
+
+        rtattr *attr = reinterpret_cast<rtattr *>(reinterpret_cast<char *>(msg) + NLMSG_ALIGN(msg->nlmsg_len));
+        attr->rta_type = type;
+        attr->rta_len = attr_len;
+
+        if (len > 0) {
+            std::memcpy(RTA_DATA(attr), data, len);
+        }
+
+        msg->nlmsg_len = NLMSG_ALIGN(msg->nlmsg_len) + RTA_ALIGN(attr_len);
+
+        return attr;
+    }
+
+    rtattr *rtnetlink::begin_nested_attr(nlmsghdr *msg, uint16_t type) {
+        return add_attr(msg, type, nullptr, 0);
+    }
 
-        return ret;
+    void rtnetlink::end_nested_attr(nlmsghdr *msg, rtattr *nested) {
+        nested->rta_len = reinterpret_cast<char *>(msg) + msg->nlmsg_len - reinterpret_cast<char *>(nested);
     }
 }
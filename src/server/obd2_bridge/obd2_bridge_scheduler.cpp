@@ -0,0 +1,260 @@
+#include "obd2_bridge.h"
+
+#include <algorithm>
+
+namespace obd2_server {
+    // J1979 allows up to six PIDs in one Service 01 request
+    const size_t obd2_bridge::MAX_CHAINED_PIDS = 6;
+    const uint32_t obd2_bridge::CHAINING_FALLBACK_CYCLES = 3;
+
+    void obd2_bridge::schedule_requests() {
+        std::lock_guard<std::mutex> requests_lock(requests_mutex);
+
+        const auto now = std::chrono::steady_clock::now();
+        const auto published = std::chrono::system_clock::now();
+        const auto tick = std::chrono::milliseconds(tick_ms);
+
+        // Only this thread advances the epoch, right after publishing
+        const uint64_t epoch = get_refresh_epoch() + 1;
+
+        // Requests polled in the cycle that just finished publish their new values, 
+        // stamped with the time their response was received
+        for (auto &r : requests) {
+            if (r.second.polling) {
+                values.write(r.second.slot, r.second.instance.get_value(), r.second.instance.get_raw(), 
+                    get_response_time(r.second, published), epoch);
+            }
+        }
+
+        const auto previous_publish = last_publish;
+        last_publish = published;
+
+        // Groups polled in the last cycle move on to their next deadline. Deadlines that fell behind 
+        // are not caught up, so a slow bus does not cause bursts
+        for (auto &g : poll_groups) {
+            if (!g.polling) {
+                continue;
+            }
+
+            check_chained_response(g, previous_publish);
+            g.deadline += std::chrono::milliseconds(g.refresh_ms);
+
+            if (g.deadline < now) {
+                g.deadline = now;
+            }
+        }
+
+        if (poll_groups_dirty) {
+            plan_poll_groups();
+        }
+
+        // Go through the groups earliest deadline first, 
+        // so serialized ECUs always poll their most overdue group
+        std::vector<poll_group *> order;
+        std::unordered_set<uint32_t> busy_ecus;
+
+        for (auto &g : poll_groups) {
+            order.push_back(&g);
+        }
+
+        std::sort(order.begin(), order.end(), [](const poll_group *a, const poll_group *b) {
+            return a->deadline < b->deadline;
+        });
+
+        for (poll_group *g : order) {
+            // Poll everything that becomes due before the cycle after the next one
+            bool due = g->deadline < now + tick;
+
+            if (due && g->serialized) {
+                due = busy_ecus.insert(g->ecu).second;
+            }
+
+            g->polling = due;
+
+            for (const auto &id : g->members) {
+                auto it = requests.find(id);
+
+                if (it != requests.end()) {
+                    set_request_polling(it->second, due);
+                }
+            }
+        }
+    }
+
+    void obd2_bridge::plan_poll_groups() {
+        const auto now = std::chrono::steady_clock::now();
+        std::unordered_map<uint32_t, std::vector<std::pair<UUIDv4::UUID, uint32_t>>> chainable; // ECU => (Request ID, Refresh ms)
+        std::unordered_map<UUIDv4::UUID, std::chrono::steady_clock::time_point> deadlines;
+
+        // Requests keep the deadline of their old group, so registering or evicting one 
+        // does not put every group on the bus at once
+        for (const auto &g : poll_groups) {
+            for (const auto &id : g.members) {
+                deadlines[id] = g.deadline;
+            }
+        }
+
+        auto get_deadline = [&deadlines, now](const UUIDv4::UUID &id) {
+            auto it = deadlines.find(id);
+            return it != deadlines.end() ? it->second : now;
+        };
+
+        poll_groups.clear();
+        poll_groups_dirty = false;
+
+        for (const auto &r : requests) {
+            const scheduled_request &sr = r.second;
+            bool service_01 = sr.service == 0x01;
+
+            // Values are stale once they missed a few of their refreshes
+            values.set_max_age(sr.slot, std::chrono::milliseconds(STALE_REFRESH_CYCLES * get_request_refresh_ms(sr)));
+
+            if (enable_pid_chaining && service_01 && unchained_ecus.count(sr.ecu) == 0) {
+                chainable[sr.ecu].emplace_back(r.first, get_request_refresh_ms(sr));
+                continue;
+            }
+
+            // Everything else is polled on its own. With chaining enabled, the obd2 instance 
+            // would still chain Service 01 requests that are due together, so those are serialized
+            poll_group g;
+            g.ecu = sr.ecu;
+            g.members.push_back(r.first);
+            g.refresh_ms = get_request_refresh_ms(sr);
+            g.deadline = get_deadline(r.first);
+            g.serialized = enable_pid_chaining && service_01;
+
+            poll_groups.push_back(std::move(g));
+        }
+
+        // Pack each ECU's requests into groups of up to MAX_CHAINED_PIDS distinct PIDs. 
+        // Sorting by rate first keeps fast channels from dragging slow ones along
+        for (auto &ecu : chainable) {
+            auto &ecu_requests = ecu.second;
+
+            std::sort(ecu_requests.begin(), ecu_requests.end(), [](const auto &a, const auto &b) {
+                return a.second < b.second;
+            });
+
+            std::unordered_set<uint16_t> group_pids;
+            poll_group g;
+
+            for (const auto &r : ecu_requests) {
+                uint16_t pid = requests.at(r.first).pid;
+
+                if (group_pids.count(pid) == 0 && group_pids.size() == MAX_CHAINED_PIDS) {
+                    g.chained = group_pids.size() > 1;
+                    poll_groups.push_back(std::move(g));
+
+                    g = poll_group();
+                    group_pids.clear();
+                }
+
+                // The first member has the shortest refresh interval of the group
+                if (g.members.empty()) {
+                    g.ecu = ecu.first;
+                    g.refresh_ms = r.second;
+                    g.deadline = get_deadline(r.first);
+                }
+
+                g.deadline = std::min(g.deadline, get_deadline(r.first));
+                g.members.push_back(r.first);
+                group_pids.insert(pid);
+            }
+
+            if (!g.members.empty()) {
+                g.chained = group_pids.size() > 1;
+                poll_groups.push_back(std::move(g));
+            }
+        }
+    }
+
+    void obd2_bridge::check_chained_response(poll_group &group, std::chrono::system_clock::time_point since) {
+        if (!group.chained || !is_connected) {
+            return;
+        }
+
+        bool any_supported = false;
+
+        for (const auto &id : group.members) {
+            auto it = requests.find(id);
+
+            if (it == requests.end() || !is_pid_supported(it->second.ecu, it->second.service, it->second.pid)) {
+                continue;
+            }
+
+            any_supported = true;
+
+            if (answered_since(it->second, since)) {
+                group.unanswered_cycles = 0;
+                return;
+            }
+        }
+
+        // Silence is expected from PIDs the car does not have
+        if (!any_supported) {
+            return;
+        }
+
+        if (++group.unanswered_cycles < CHAINING_FALLBACK_CYCLES) {
+            return;
+        }
+
+        // The ECU does not answer multi-PID requests, poll its PIDs one at a time from now on
+        std::cerr << "ECU " << std::hex << std::uppercase << group.ecu << std::dec
+            << " does not answer chained requests, disabling chaining for it" << std::endl;
+
+        unchained_ecus.insert(group.ecu);
+        poll_groups_dirty = true;
+    }
+
+    bool obd2_bridge::answered_since(scheduled_request &r, std::chrono::system_clock::time_point since) {
+        // Without the capture socket, only requests that never got any answer are known to be unanswered
+        if (!is_capturing) {
+            return !r.instance.get_raw().empty();
+        }
+
+        // The first PID of a chained response is recorded under its own key
+        std::lock_guard<std::mutex> rx_times_lock(rx_times_mutex);
+        auto it = rx_times.find(get_pid_key(r.ecu, r.service, r.pid));
+
+        return it != rx_times.end() && it->second >= since;
+    }
+
+    void obd2_bridge::set_request_polling(scheduled_request &r, bool polling) {
+        if (r.polling == polling) {
+            return;
+        }
+
+        if (polling) {
+            r.instance.resume();
+        }
+        else {
+            r.instance.stop();
+        }
+
+        r.polling = polling;
+    }
+
+    void obd2_bridge::update_refresh_tick() {
+        // The obd2 instance cycles at the rate of the fastest registered request,
+        // slower requests are skipped by schedule_requests until they are due
+        uint32_t tick = refresh_ms;
+
+        for (const auto &r : requests) {
+            tick = std::min(tick, get_request_refresh_ms(r.second));
+        }
+
+        tick = std::max(tick, MIN_REFRESH_MS);
+
+        if (tick == tick_ms) {
+            return;
+        }
+
+        tick_ms = tick;
+        instance.set_refresh_ms(tick);
+    }
+
+    uint32_t obd2_bridge::get_request_refresh_ms(const scheduled_request &r) const {
+        return r.refresh_ms != 0 ? r.refresh_ms : refresh_ms.load();
+    }
+}
@@ -0,0 +1,167 @@
+#include "obd2_bridge.h"
+
+#include <cctype>
+#include <fstream>
+#include <list>
+
+namespace obd2_server {
+    const std::chrono::milliseconds obd2_bridge::VIN_READ_TIMEOUT = std::chrono::milliseconds(3000);
+
+    void obd2_bridge::load_pid_support() {
+        std::unordered_map<uint32_t, pid_support> support;
+        std::string vin = read_vin();
+        std::string path;
+
+        {
+            std::lock_guard<std::mutex> support_lock(support_mutex);
+
+            // Without a VIN the car cannot be recognized on the next connection
+            if (!vin.empty() && !support_cache_dir.empty()) {
+                path = support_cache_dir + "/" + vin + ".json";
+            }
+        }
+
+        std::ifstream file(path);
+
+        if (file.is_open()) {
+            try {
+                nlohmann::json j = nlohmann::json::parse(file);
+
+                for (const auto &ecu_j : j.at("ecus")) {
+                    pid_support &s = support[ecu_j.at("id").template get<uint32_t>()];
+
+                    s.service_01 = std::bitset<256>(ecu_j.at("service_01").template get<std::string>());
+                    s.service_09 = std::bitset<256>(ecu_j.at("service_09").template get<std::string>());
+                }
+
+                std::cout << "Loaded supported PIDs of " << vin << std::endl;
+            }
+            catch (const std::exception &e) {
+                std::cerr << "Could not load supported PIDs from " << path << ": " << e.what() << std::endl;
+                support.clear();
+            }
+        }
+
+        // Unknown car, ask the obd2 instance once for every PID with a support bitmap
+        if (support.empty()) {
+            nlohmann::json j;
+            j["vin"] = vin;
+            j["ecus"] = nlohmann::json::array();
+
+            for (const auto &ecu : instance.get_ecus()) {
+                uint32_t ecu_id = ecu.get().get_id();
+                pid_support &s = support[ecu_id];
+
+                for (uint16_t pid = 0; pid < s.service_01.size(); pid++) {
+                    s.service_01[pid] = instance.pid_supported(ecu_id, 0x01, pid);
+                    s.service_09[pid] = instance.pid_supported(ecu_id, 0x09, pid);
+                }
+
+                j["ecus"].push_back({
+                    {"id", ecu_id},
+                    {"service_01", s.service_01.to_string()},
+                    {"service_09", s.service_09.to_string()}
+                });
+            }
+
+            if (!path.empty() && !support.empty()) {
+                std::ofstream out(path, std::fstream::trunc);
+                out << j.dump(4);
+            }
+        }
+
+        std::lock_guard<std::mutex> support_lock(support_mutex);
+
+        supported_pids = std::move(support);
+        probed_pids.clear();
+        this->vin = vin;
+        support_loaded = true;
+    }
+
+    void obd2_bridge::reset_pid_support() {
+        std::lock_guard<std::mutex> support_lock(support_mutex);
+
+        supported_pids.clear();
+        probed_pids.clear();
+        vin.clear();
+        support_loaded = false;
+    }
+
+    bool obd2_bridge::is_pid_supported(uint32_t ecu, uint8_t service, uint16_t pid) {
+        std::lock_guard<std::mutex> support_lock(support_mutex);
+
+        // Until the bitmaps are loaded, fall back to asking the obd2 instance every time
+        if (!support_loaded) {
+            return instance.pid_supported(ecu, service, pid);
+        }
+
+        if ((service == 0x01 || service == 0x09) && pid < 256) {
+            auto it = supported_pids.find(ecu);
+
+            if (it == supported_pids.end()) {
+                return false;
+            }
+
+            return service == 0x01 ? it->second.service_01[pid] : it->second.service_09[pid];
+        }
+
+        uint64_t key = get_pid_key(ecu, service, pid);
+        auto it = probed_pids.find(key);
+
+        if (it == probed_pids.end()) {
+            it = probed_pids.try_emplace(key, instance.pid_supported(ecu, service, pid)).first;
+        }
+
+        return it->second;
+    }
+
+    std::string obd2_bridge::read_vin() {
+        // Any ECU may answer Service 09 PID 02, the engine ECU usually does. All are asked at 
+        // once and share one deadline, so a car without a VIN holds up the connection thread only once
+        std::list<obd2::request> vin_requests;
+
+        for (const auto &ecu : instance.get_ecus()) {
+            vin_requests.emplace_back(ecu.get().get_id(), 0x09, 0x02, instance, "", true);
+        }
+
+        const auto deadline = std::chrono::steady_clock::now() + VIN_READ_TIMEOUT;
+        uint64_t epoch = get_refresh_epoch();
+
+        while (!vin_requests.empty() && connection_thread_running) {
+            auto now = std::chrono::steady_clock::now();
+
+            if (now >= deadline) {
+                break;
+            }
+
+            epoch = await_new_data(epoch, std::chrono::ceil<std::chrono::milliseconds>(deadline - now));
+
+            for (auto &vin_request : vin_requests) {
+                // Skip the leading item count and any padding
+                std::string vin;
+
+                for (uint8_t c : vin_request.get_raw()) {
+                    if (std::isalnum(c)) {
+                        vin += static_cast<char>(c);
+                    }
+                }
+
+                if (vin.size() >= 17) {
+                    return vin.substr(vin.size() - 17);
+                }
+            }
+        }
+
+        return "";
+    }
+
+    void obd2_bridge::set_support_cache_dir(const std::string &path) {
+        std::lock_guard<std::mutex> support_lock(support_mutex);
+        support_cache_dir = path;
+    }
+
+    std::string obd2_bridge::get_vin() {
+        std::lock_guard<std::mutex> support_lock(support_mutex);
+        return vin;
+    }
+}
@@ -0,0 +1,165 @@
+#include "value_table.h"
+
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace obd2_server {
+    value_table::value_table(size_t capacity) : slots(std::make_unique<slot[]>(capacity)), capacity(capacity) {
+        for (size_t i = 0; i < capacity; i++) {
+            slots[i].value.store(std::numeric_limits<float>::quiet_NaN(), std::memory_order_relaxed);
+            slots[i].reference = std::numeric_limits<float>::quiet_NaN();
+        }
+    }
+
+    void value_table::write(size_t slot, float value, const std::vector<uint8_t> &raw, 
+        std::chrono::system_clock::time_point timestamp, uint64_t epoch) {
+        auto &s = slots[slot];
+        std::array<uint64_t, RAW_WORDS> words = { };
+        size_t raw_size = std::min(raw.size(), MAX_RAW_SIZE);
+
+        std::memcpy(words.data(), raw.data(), raw_size);
+
+        begin_write(s);
+
+        s.value.store(value, std::memory_order_relaxed);
+        s.raw_size.store(raw_size, std::memory_order_relaxed);
+        s.timestamp.store(timestamp.time_since_epoch().count(), std::memory_order_relaxed);
+
+        for (size_t i = 0; i < RAW_WORDS; i++) {
+            s.raw[i].store(words[i], std::memory_order_relaxed);
+        }
+
+        end_write(s);
+
+        // Published after the value, so readers that see the new epoch also read the new value
+        bool changed = std::isnan(value) != std::isnan(s.reference) 
+            || std::abs(value - s.reference) > s.deadband.load(std::memory_order_relaxed);
+
+        if (changed) {
+            s.reference = value;
+            s.changed_epoch.store(epoch, std::memory_order_release);
+        }
+    }
+
+    void value_table::clear(size_t slot) {
+        auto &s = slots[slot];
+
+        begin_write(s);
+        s.value.store(std::numeric_limits<float>::quiet_NaN(), std::memory_order_relaxed);
+        s.raw_size.store(0, std::memory_order_relaxed);
+        s.timestamp.store(0, std::memory_order_relaxed);
+        end_write(s);
+
+        s.reference = std::numeric_limits<float>::quiet_NaN();
+    }
+
+    void value_table::set_registered(size_t slot, bool registered) {
+        slots[slot].registered.store(registered, std::memory_order_release);
+    }
+
+    void value_table::set_max_age(size_t slot, std::chrono::milliseconds max_age) {
+        slots[slot].max_age_ms.store(max_age.count(), std::memory_order_relaxed);
+    }
+
+    void value_table::set_deadband(size_t slot, float deadband) {
+        slots[slot].deadband.store(deadband, std::memory_order_relaxed);
+    }
+
+    float value_table::read_value(size_t slot) const {
+        const auto &s = slots[slot];
+        uint32_t sequence;
+        float value;
+
+        do {
+            sequence = s.sequence.load(std::memory_order_acquire);
+            value = s.value.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((sequence & 1) || sequence != s.sequence.load(std::memory_order_relaxed));
+
+        return value;
+    }
+
+    value_sample value_table::read_sample(size_t slot) const {
+        const auto &s = slots[slot];
+        uint32_t sequence;
+        float value;
+        std::chrono::system_clock::rep timestamp;
+
+        do {
+            sequence = s.sequence.load(std::memory_order_acquire);
+            value = s.value.load(std::memory_order_relaxed);
+            timestamp = s.timestamp.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((sequence & 1) || sequence != s.sequence.load(std::memory_order_relaxed));
+
+        value_sample sample;
+        sample.value = value;
+        sample.timestamp = std::chrono::system_clock::time_point(std::chrono::system_clock::duration(timestamp));
+
+        // Values that were never received are stale as well
+        uint32_t max_age_ms = s.max_age_ms.load(std::memory_order_relaxed);
+        sample.stale = max_age_ms != 0 
+            && std::chrono::system_clock::now() - sample.timestamp > std::chrono::milliseconds(max_age_ms);
+
+        return sample;
+    }
+
+    std::vector<uint8_t> value_table::read_raw(size_t slot) const {
+        const auto &s = slots[slot];
+        std::array<uint64_t, RAW_WORDS> words;
+        uint32_t sequence;
+        size_t raw_size;
+
+        do {
+            sequence = s.sequence.load(std::memory_order_acquire);
+            raw_size = s.raw_size.load(std::memory_order_relaxed);
+
+            for (size_t i = 0; i < RAW_WORDS; i++) {
+                words[i] = s.raw[i].load(std::memory_order_relaxed);
+            }
+
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((sequence & 1) || sequence != s.sequence.load(std::memory_order_relaxed));
+
+        std::vector<uint8_t> raw(raw_size);
+        std::memcpy(raw.data(), words.data(), raw_size);
+
+        return raw;
+    }
+
+    uint64_t value_table::read_changed_epoch(size_t slot) const {
+        return slots[slot].changed_epoch.load(std::memory_order_acquire);
+    }
+
+    bool value_table::get_registered(size_t slot) const {
+        return slots[slot].registered.load(std::memory_order_acquire);
+    }
+
+    void value_table::touch(size_t slot) {
+        slots[slot].last_read.store(
+            std::chrono::steady_clock::now().time_since_epoch().count(), 
+            std::memory_order_relaxed
+        );
+    }
+
+    std::chrono::steady_clock::time_point value_table::get_last_read(size_t slot) const {
+        return std::chrono::steady_clock::time_point(
+            std::chrono::steady_clock::duration(slots[slot].last_read.load(std::memory_order_relaxed))
+        );
+    }
+
+    size_t value_table::get_capacity() const {
+        return capacity;
+    }
+
+    void value_table::begin_write(slot &s) {
+        // Odd sequence numbers mark a write in progress, readers retry until it is even again
+        s.sequence.store(s.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void value_table::end_write(slot &s) {
+        s.sequence.store(s.sequence.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace obd2_server {
+    // A value together with the time it was received from the bus
+    struct value_sample {
+        float value;
+        std::chrono::system_clock::time_point timestamp; // Epoch while nothing was received
+        bool stale; // Older than the slot's max age
+    };
+
+    // Fixed-size table of request values, written by a single writer at a time 
+    // and read lock-free through a per-slot seqlock
+    class value_table {
+        public:
+            static constexpr size_t MAX_RAW_SIZE = 64;
+
+            value_table(size_t capacity);
+            value_table(const value_table &t) = delete;
+            value_table(value_table &&t) = delete;
+
+            value_table &operator=(const value_table &t) = delete;
+            value_table &operator=(value_table &&t) = delete;
+
+            // Writers must be serialized by the caller. The slot's changed epoch is set to epoch 
+            // when the value moved beyond the deadband since the last change
+            void write(size_t slot, float value, const std::vector<uint8_t> &raw, 
+                std::chrono::system_clock::time_point timestamp, uint64_t epoch);
+            void clear(size_t slot);
+            void set_registered(size_t slot, bool registered);
+            void set_max_age(size_t slot, std::chrono::milliseconds max_age);
+            void set_deadband(size_t slot, float deadband);
+
+            float read_value(size_t slot) const;
+            value_sample read_sample(size_t slot) const;
+            std::vector<uint8_t> read_raw(size_t slot) const;
+            uint64_t read_changed_epoch(size_t slot) const;
+            bool get_registered(size_t slot) const;
+
+            void touch(size_t slot);
+            std::chrono::steady_clock::time_point get_last_read(size_t slot) const;
+
+            size_t get_capacity() const;
+
+        private:
+            static constexpr size_t RAW_WORDS = MAX_RAW_SIZE / sizeof(uint64_t);
+
+            struct slot {
+                std::atomic<uint32_t> sequence = 0;
+                std::atomic<float> value;
+                std::atomic<uint8_t> raw_size = 0;
+                std::array<std::atomic<uint64_t>, RAW_WORDS> raw;
+                std::atomic<std::chrono::system_clock::rep> timestamp = 0;
+
+                std::atomic<bool> registered = false;
+                std::atomic<std::chrono::steady_clock::rep> last_read = 0;
+                std::atomic<uint32_t> max_age_ms = 0; // 0 => never stale
+
+                // Last value that counted as a change, only touched by the writer
+                float reference;
+                std::atomic<float> deadband = 0.0f;
+                std::atomic<uint64_t> changed_epoch = 0;
+            };
+
+            std::unique_ptr<slot[]> slots;
+            size_t capacity;
+
+            void begin_write(slot &s);
+            void end_write(slot &s);
+    };
+}
@@ -0,0 +1,65 @@
+#include "response_cache.h"
+
+#include <iomanip>
+#include <sstream>
+
+namespace obd2_server {
+    response_cache::response_cache() { }
+
+    void response_cache::invalidate() {
+        std::lock_guard<std::mutex> lock(mutex);
+        version++;
+    }
+
+    std::shared_ptr<const response_cache::entry> response_cache::get(const std::function<std::string()> &build, uint64_t key) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (current && built_version == version && built_key == key) {
+            return current;
+        }
+
+        current = make_entry(build());
+        built_version = version;
+        built_key = key;
+
+        return current;
+    }
+
+    std::shared_ptr<const response_cache::entry> response_cache::make_entry(std::string body) {
+        auto e = std::make_shared<entry>();
+        e->body = std::move(body);
+
+        // The ETag is derived from the content, so it stays valid across restarts
+        std::stringstream ss;
+        ss << "\"" << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(e->body) << "\"";
+        e->etag = ss.str();
+
+        // Compress once here instead of on every response
+        if (content_encoding_supported(content_encoding::GZIP)) {
+            e->gzip_body = compress(e->body, content_encoding::GZIP);
+        }
+
+        if (content_encoding_supported(content_encoding::BROTLI)) {
+            e->brotli_body = compress(e->body, content_encoding::BROTLI);
+        }
+
+        return e;
+    }
+
+    const std::string &response_cache::entry::get_body(content_encoding encoding) const {
+        if (encoding == content_encoding::GZIP && !gzip_body.empty()) {
+            return gzip_body;
+        }
+
+        if (encoding == content_encoding::BROTLI && !brotli_body.empty()) {
+            return brotli_body;
+        }
+
+        return body;
+    }
+
+    uint64_t response_cache::get_version() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return version;
+    }
+}
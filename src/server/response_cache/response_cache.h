@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "../compression/compression.h"
+
+namespace obd2_server {
+    // A serialized response body that is only rebuilt after its source data changed
+    class response_cache {
+        public:
+            struct entry {
+                std::string body;
+                std::string gzip_body;      // Empty without gzip support
+                std::string brotli_body;    // Empty without brotli support
+                std::string etag;
+
+                const std::string &get_body(content_encoding encoding) const;
+            };
+
+            response_cache();
+            response_cache(const response_cache &c) = delete;
+            response_cache(response_cache &&c) = delete;
+
+            response_cache &operator=(const response_cache &c) = delete;
+            response_cache &operator=(response_cache &&c) = delete;
+
+            void invalidate();
+
+            // Rebuilds the body and its compressed variants with build when the cache was invalidated or the key differs 
+            // from the one the current body was built with
+            std::shared_ptr<const entry> get(const std::function<std::string()> &build, uint64_t key = 0);
+
+            // An entry with its ETag and compressed variants, for bodies that are cached elsewhere
+            static std::shared_ptr<const entry> make_entry(std::string body);
+
+            uint64_t get_version() const;
+
+        private:
+            mutable std::mutex mutex;
+            std::shared_ptr<const entry> current;
+            uint64_t version = 1;
+            uint64_t built_version = 0;
+            uint64_t built_key = 0;
+    };
+}
@@ -1,7 +1,9 @@
 #include "server.h"
 
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <unordered_set>
 
 namespace obd2_server {
     server::server() : server(DEFAULT_CONFIG_PATH) { }
@@ -26,15 +28,43 @@ namespace obd2_server {
         std::cout << "Loaded " << loaded_logs << " logs" << std::endl;
 
         setup_routes();
+        setup_http_workers();
 
-        // Initialize obd2 bridge
-        obd2 = std::make_unique<obd2_bridge>(obd2_can_device, obd2_skip_can_setup, 
-            obd2_bitrate_discovery, obd2_can_bitrate, obd2_refresh_ms, obd2_use_pid_chaining);
-        obd2->set_obd2_refresh_cb(std::bind(&server::handle_obd2_refresh, this));
+        log_writer_running = true;
+        log_writer_thread = std::thread(&server::log_writer_loop, this);
+
+        log_maintenance_running = true;
+        log_maintenance_thread = std::thread(&server::log_maintenance_loop, this);
+
+        // Initialize obd2 bridges
+        create_bridges();
     }
 
     server::~server() {
         stop_server();
+
+        {
+            std::lock_guard<std::mutex> writer_lock(log_writer_mutex);
+            log_writer_running = false;
+        }
+
+        log_writer_cv.notify_all();
+
+        if (log_writer_thread.joinable()) {
+            log_writer_thread.join();
+        }
+
+        {
+            std::lock_guard<std::mutex> maintenance_lock(log_maintenance_mutex);
+            log_maintenance_running = false;
+        }
+
+        log_maintenance_cv.notify_all();
+
+        if (log_maintenance_thread.joinable()) {
+            log_maintenance_thread.join();
+        }
+
         save_server_config();
     }
 
@@ -62,6 +92,34 @@ namespace obd2_server {
         server_instance.listen(server_address, server_port);
     }
 
+    void server::setup_http_workers() {
+        // Read when the server starts listening, so changes apply on the next start
+        server_instance.new_task_queue = [this]() {
+            return new metered_task_queue(server_threads, http_metrics);
+        };
+
+        server_instance.set_keep_alive_max_count(server_keep_alive_max_count);
+        server_instance.set_keep_alive_timeout(server_keep_alive_timeout_s);
+    }
+
+    bool server::try_begin_long_poll() {
+        // At least one worker always stays free for short requests
+        uint32_t limit = std::min(server_long_poll_threads, server_threads - 1);
+        uint32_t active = long_polls_active.load();
+
+        do {
+            if (active >= limit) {
+                return false;
+            }
+        } while (!long_polls_active.compare_exchange_weak(active, active + 1));
+
+        return true;
+    }
+
+    void server::end_long_poll() {
+        long_polls_active--;
+    }
+
     void server::set_obd2_can_device(const std::string &device) {
         obd2_can_device = device;
     }
@@ -98,6 +156,18 @@ namespace obd2_server {
         obd2_skip_can_setup = skip_can_setup;
     }
 
+    void server::set_obd2_request_ttl_ms(uint32_t ttl_ms) {
+        obd2_request_ttl_ms = ttl_ms;
+
+        for (auto &bridge : bridges) {
+            bridge.second->set_request_ttl_ms(ttl_ms);
+        }
+    }
+
+    void server::set_obd2_buses(const std::vector<obd2_bus_config> &buses) {
+        obd2_buses = buses;
+    }
+
     void server::set_server_address(const std::string &address) {
         server_address = address;
     }
@@ -106,6 +176,56 @@ namespace obd2_server {
         server_port = port;
     }
 
+    void server::set_server_threads(uint32_t threads) {
+        server_threads = std::max(threads, 2u);
+    }
+
+    void server::set_server_long_poll_threads(uint32_t threads) {
+        server_long_poll_threads = std::max(threads, 1u);
+    }
+
+    void server::set_server_keep_alive_max_count(uint32_t count) {
+        server_keep_alive_max_count = count;
+        server_instance.set_keep_alive_max_count(count);
+    }
+
+    void server::set_server_keep_alive_timeout_s(uint32_t timeout_s) {
+        server_keep_alive_timeout_s = timeout_s;
+        server_instance.set_keep_alive_timeout(timeout_s);
+    }
+
+    void server::set_log_flush_interval_ms(uint32_t interval_ms) {
+        log_flush_interval_ms = std::max(interval_ms, 1u);
+    }
+
+    void server::set_log_fsync(bool fsync) {
+        log_fsync = fsync;
+    }
+
+    void server::set_log_format(log_format format) {
+        log_file_format = format;
+    }
+
+    void server::set_log_segment_max_bytes(uint64_t max_bytes) {
+        log_segment_max_bytes = max_bytes;
+    }
+
+    void server::set_log_segment_max_s(uint32_t max_s) {
+        log_segment_max_s = max_s;
+    }
+
+    void server::set_log_compress(bool compress) {
+        log_compress = compress;
+    }
+
+    void server::set_log_retention_max_bytes(uint64_t max_bytes) {
+        log_retention_max_bytes = max_bytes;
+    }
+
+    void server::set_log_retention_max_age_s(uint32_t max_age_s) {
+        log_retention_max_age_s = max_age_s;
+    }
+
     void server::set_config_path(const std::string &path) {
         config_path = path;
     }
@@ -122,6 +242,14 @@ namespace obd2_server {
         logs_dir = path;
     }
 
+    void server::set_support_cache_dir(const std::string &path) {
+        support_cache_dir = path;
+
+        for (auto &bridge : bridges) {
+            bridge.second->set_support_cache_dir(get_support_cache_dir());
+        }
+    }
+
     const std::string &server::get_obd2_can_device() const {
         return obd2_can_device;
     }
@@ -158,6 +286,14 @@ namespace obd2_server {
         return obd2_skip_can_setup;
     }
 
+    uint32_t server::get_obd2_request_ttl_ms() const {
+        return obd2_request_ttl_ms;
+    }
+
+    const std::vector<obd2_bus_config> &server::get_obd2_buses() const {
+        return obd2_buses;
+    }
+
     const std::string &server::get_server_address() const {
         return server_address;
     }
@@ -166,6 +302,54 @@ namespace obd2_server {
         return server_port;
     }
 
+    uint32_t server::get_server_threads() const {
+        return server_threads;
+    }
+
+    uint32_t server::get_server_long_poll_threads() const {
+        return server_long_poll_threads;
+    }
+
+    uint32_t server::get_server_keep_alive_max_count() const {
+        return server_keep_alive_max_count;
+    }
+
+    uint32_t server::get_server_keep_alive_timeout_s() const {
+        return server_keep_alive_timeout_s;
+    }
+
+    uint32_t server::get_log_flush_interval_ms() const {
+        return log_flush_interval_ms;
+    }
+
+    bool server::get_log_fsync() const {
+        return log_fsync;
+    }
+
+    log_format server::get_log_format() const {
+        return log_file_format;
+    }
+
+    uint64_t server::get_log_segment_max_bytes() const {
+        return log_segment_max_bytes;
+    }
+
+    uint32_t server::get_log_segment_max_s() const {
+        return log_segment_max_s;
+    }
+
+    bool server::get_log_compress() const {
+        return log_compress;
+    }
+
+    uint64_t server::get_log_retention_max_bytes() const {
+        return log_retention_max_bytes;
+    }
+
+    uint32_t server::get_log_retention_max_age_s() const {
+        return log_retention_max_age_s;
+    }
+
     std::string server::get_config_path() const {
         return expand_path(config_path);
     }
@@ -182,35 +366,363 @@ namespace obd2_server {
         return expand_path(logs_dir);
     }
 
-    void server::handle_obd2_refresh() {
-        process_logs();
+    std::string server::get_support_cache_dir() const {
+        return expand_path(support_cache_dir);
     }
 
-    void server::process_logs() {
-        for (auto &log : logs) {
-            if (!log.second.get_is_logging()) {
+    void server::create_bridges() {
+        bridges.clear();
+        vehicle_bus_map.clear();
+
+        // The primary bus serves every vehicle that is not bound to another bus
+        add_bridge(obd2_can_device, obd2_skip_can_setup, obd2_bitrate_discovery, 
+            obd2_can_bitrate, obd2_refresh_ms, obd2_use_pid_chaining);
+        obd2 = bridges.at(obd2_can_device).get();
+
+        for (const auto &bus : obd2_buses) {
+            if (bridges.find(bus.can_device) != bridges.end()) {
+                std::cerr << "CAN device " << bus.can_device << " is configured more than once" << std::endl;
+                continue;
+            }
+
+            try {
+                add_bridge(bus.can_device, bus.skip_can_setup, bus.bitrate_discovery, 
+                    bus.can_bitrate, bus.refresh_ms, bus.use_pid_chaining);
+            }
+            catch (const std::exception &e) {
+                std::cerr << "Could not set up bus " << bus.can_device << ": " << e.what() << std::endl;
+                continue;
+            }
+
+            for (const auto &vehicle_id : bus.vehicles) {
+                vehicle_bus_map[vehicle_id] = bus.can_device;
+            }
+        }
+    }
+
+    void server::add_bridge(const std::string &device, bool skip_can_setup, bool bitrate_discovery,
+        uint32_t bitrate, uint32_t refresh_ms, bool use_pid_chaining) {
+        auto bridge = std::make_unique<obd2_bridge>(device, skip_can_setup, bitrate_discovery, 
+            bitrate, refresh_ms, use_pid_chaining);
+
+        bridge->set_obd2_refresh_cb(std::bind(&server::handle_obd2_refresh, this, device));
+        bridge->set_request_ttl_ms(obd2_request_ttl_ms);
+        bridge->set_support_cache_dir(get_support_cache_dir());
+
+        bridges.try_emplace(device, std::move(bridge));
+    }
+
+    void server::handle_obd2_refresh(const std::string &bus) {
+        process_logs(bus);
+    }
+
+    void server::process_logs(const std::string &bus) {
+        auto current_logs = logs.load();
+        auto buses = log_bus_map.load();
+        const auto now = std::chrono::system_clock::now();
+
+        for (const auto &log : *current_logs) {
+            if (!log.second->get_is_logging()) {
+                continue;
+            }
+
+            // Every log is sampled on the refresh of exactly one bus
+            auto bus_it = buses->find(log.first);
+
+            if (bus_it == buses->end() || bus_it->second != bus) {
                 continue;
             }
 
-            if (log.second.get_is_raw()) {
-                auto data = get_raw_data_for_ids(log.second.get_request_ids());
-                log.second.add_data_raw(data);
+            // Only copies the values into the log's ring, the log writer formats and writes them
+            if (log.second->get_is_raw()) {
+                log.second->add_data_raw(now, [this](const UUIDv4::UUID &id) {
+                    return get_request_bridge(id).get_request_raw(id);
+                });
             }
             else {
-                std::unordered_map<UUIDv4::UUID, float> data = get_data_for_ids(log.second.get_request_ids());
-                log.second.add_data(data);
+                log.second->add_data(now, [this](const UUIDv4::UUID &id) {
+                    return get_request_bridge(id).get_request_sample(id);
+                });
             }
         }
     }
 
-    request &server::get_request(const UUIDv4::UUID &id) {
-        UUIDv4::UUID vehicle_id = request_vehicle_map.at(id);
-        auto it = vehicles.find(vehicle_id);
+    void server::log_writer_loop() {
+        std::unique_lock<std::mutex> writer_lock(log_writer_mutex);
 
-        if (it == vehicles.end()) {
+        while (log_writer_running) {
+            log_writer_cv.wait_for(writer_lock, std::chrono::milliseconds(log_flush_interval_ms.load()), 
+                [this] { return !log_writer_running; });
+
+            writer_lock.unlock();
+            write_logs();
+            writer_lock.lock();
+        }
+    }
+
+    void server::write_logs() {
+        for (const auto &log : *logs.load()) {
+            try {
+                log.second->write_pending(log_fsync);
+            }
+            catch (const std::exception &e) {
+                std::cerr << "Could not write log " << log.first << ": " << e.what() << std::endl;
+            }
+
+            // Also collects the last segment of logs stopped since the previous pass
+            std::vector<std::string> closed = log.second->take_closed_segments();
+
+            if (!closed.empty()) {
+                queue_log_segments(closed);
+            }
+        }
+    }
+
+    void server::queue_log_segments(const std::vector<std::string> &paths) {
+        {
+            std::lock_guard<std::mutex> maintenance_lock(log_maintenance_mutex);
+            pending_log_segments.insert(pending_log_segments.end(), paths.begin(), paths.end());
+        }
+
+        log_maintenance_cv.notify_all();
+    }
+
+    void server::log_maintenance_loop() {
+        std::unique_lock<std::mutex> maintenance_lock(log_maintenance_mutex);
+        auto next_retention = std::chrono::steady_clock::now();
+
+        while (log_maintenance_running) {
+            log_maintenance_cv.wait_for(maintenance_lock, SUBSCRIPTION_SWEEP_INTERVAL, 
+                [this] { return !log_maintenance_running || !pending_log_segments.empty(); });
+
+            std::deque<std::string> segments;
+            segments.swap(pending_log_segments);
+
+            maintenance_lock.unlock();
+
+            // Segments left over at shutdown are queued again by load_logs on the next start
+            for (const auto &path : segments) {
+                if (!log_maintenance_running) {
+                    break;
+                }
+
+                compress_log_segment(path);
+            }
+
+            // Subscriptions expire on this timer rather than on bus refreshes, 
+            // so their leases also run out while every bus is idle or disconnected
+            expire_subscriptions();
+
+            // New segments may have pushed the logs over the quota
+            const auto now = std::chrono::steady_clock::now();
+
+            if (!segments.empty() || now >= next_retention) {
+                apply_log_retention();
+                next_retention = now + LOG_RETENTION_INTERVAL;
+            }
+
+            maintenance_lock.lock();
+        }
+    }
+
+    void server::compress_log_segment(const std::string &path) {
+        const std::string compressed_path = path + get_file_extension(data_log::SEGMENT_ENCODING);
+        const std::string tmp_path = compressed_path + ".tmp";
+
+        if (!log_compress || !std::filesystem::exists(path)) {
+            return;
+        }
+
+        // Readers find either file complete, the uncompressed one is only removed after the rename
+        try {
+            compress_file(path, tmp_path, data_log::SEGMENT_ENCODING);
+
+            // Retention goes by the time the segment was closed
+            std::filesystem::last_write_time(tmp_path, std::filesystem::last_write_time(path));
+            std::filesystem::rename(tmp_path, compressed_path);
+            std::filesystem::remove(path);
+        }
+        catch (const std::exception &e) {
+            std::cerr << "Could not compress log segment " << path << ": " << e.what() << std::endl;
+
+            std::error_code ec;
+            std::filesystem::remove(tmp_path, ec);
+        }
+    }
+
+    void server::apply_log_retention() {
+        const uint64_t max_bytes = log_retention_max_bytes;
+        const std::chrono::seconds max_age(log_retention_max_age_s.load());
+
+        if (max_bytes == 0 && max_age.count() == 0) {
+            return;
+        }
+
+        auto current_logs = logs.load();
+        std::vector<std::pair<std::string, log_segment>> closed; // Log name, segment
+        uint64_t total_size = 0;
+
+        // Segments that are still written to count towards the quota, but are never removed
+        for (const auto &log : *current_logs) {
+            for (auto &segment : log.second->get_segments()) {
+                total_size += segment.size;
+
+                if (!segment.active) {
+                    closed.emplace_back(log.first, std::move(segment));
+                }
+            }
+        }
+
+        std::sort(closed.begin(), closed.end(), [](const auto &a, const auto &b) {
+            return a.second.write_time < b.second.write_time;
+        });
+
+        const auto now = std::filesystem::file_time_type::clock::now();
+        std::unordered_set<std::string> pruned;
+
+        // Oldest first, until the rest is young enough and fits into the quota
+        for (const auto &c : closed) {
+            bool expired = max_age.count() > 0 && now - c.second.write_time > max_age;
+            bool over_quota = max_bytes > 0 && total_size > max_bytes;
+
+            if (!expired && !over_quota) {
+                break;
+            }
+
+            std::error_code ec;
+
+            if (!std::filesystem::remove(c.second.path, ec)) {
+                if (ec) {
+                    std::cerr << "Could not remove log segment " << c.second.path << ": " << ec.message() << std::endl;
+                }
+
+                continue;
+            }
+
+            total_size -= c.second.size;
+            pruned.insert(c.first);
+        }
+
+        if (pruned.empty()) {
+            return;
+        }
+
+        std::cout << "Removed log segments of " << pruned.size() << " logs to stay within the retention limits" << std::endl;
+
+        for (const auto &name : pruned) {
+            remove_log_caches(name);
+        }
+
+        {
+            std::lock_guard<std::mutex> series_lock(log_series_cache_mutex);
+            log_series_cache.clear();
+            log_series_cache_order.clear();
+        }
+
+        // Logs without any segments left disappear from /logs
+        logs.update([&](auto &current) {
+            for (const auto &name : pruned) {
+                auto it = current.find(name);
+
+                if (it != current.end() && !it->second->get_is_logging() && it->second->get_segments().empty()) {
+                    current.erase(it);
+                }
+            }
+        });
+    }
+
+    void server::remove_log_caches(const std::string &name) {
+        for (content_encoding encoding : { content_encoding::GZIP, content_encoding::BROTLI }) {
+            std::error_code ec;
+            std::filesystem::remove(get_logs_dir() + "/" + name + ".json" + get_file_extension(encoding), ec);
+        }
+    }
+
+    void server::expire_subscriptions() {
+        std::vector<std::shared_ptr<subscription>> expired;
+        const auto now = std::chrono::steady_clock::now();
+
+        {
+            std::lock_guard<std::mutex> subscriptions_lock(subscriptions_mutex);
+
+            if (now - last_subscription_sweep < SUBSCRIPTION_SWEEP_INTERVAL) {
+                return;
+            }
+
+            last_subscription_sweep = now;
+
+            for (auto it = subscriptions.begin(); it != subscriptions.end();) {
+                auto last_used = std::chrono::steady_clock::time_point(
+                    std::chrono::steady_clock::duration(it->second->last_used.load()));
+
+                if (now - last_used > SUBSCRIPTION_TTL) {
+                    expired.push_back(it->second);
+                    it = subscriptions.erase(it);
+                }
+                else {
+                    it++;
+                }
+            }
+        }
+
+        for (const auto &sub : expired) {
+            release_subscription(*sub);
+        }
+    }
+
+    std::shared_ptr<server::subscription> server::find_subscription(const std::string &handle) {
+        std::lock_guard<std::mutex> subscriptions_lock(subscriptions_mutex);
+        auto it = subscriptions.find(handle);
+
+        if (it == subscriptions.end()) {
+            return nullptr;
+        }
+
+        it->second->last_used = std::chrono::steady_clock::now().time_since_epoch().count();
+        return it->second;
+    }
+
+    void server::release_subscription(const subscription &sub) {
+        for (size_t i = 0; i < sub.ids.size(); i++) {
+            sub.bridges[i]->release_request(sub.ids[i]);
+        }
+    }
+
+    std::shared_ptr<const request> server::get_request(const UUIDv4::UUID &id) const {
+        auto set = vehicles.load();
+        UUIDv4::UUID vehicle_id = set->request_vehicle_map.at(id);
+        auto it = set->vehicles.find(vehicle_id);
+
+        if (it == set->vehicles.end()) {
             throw std::runtime_error("Vehicle not found");
         }
 
-        return it->second.get_request(id);
+        // Shares ownership of the snapshot, so the request outlives a reload of the vehicles
+        return std::shared_ptr<const request>(set, &it->second.get_request(id));
+    }
+
+    const std::string &server::get_vehicle_bus(const UUIDv4::UUID &vehicle_id) const {
+        auto it = vehicle_bus_map.find(vehicle_id);
+
+        if (it == vehicle_bus_map.end()) {
+            return obd2_can_device;
+        }
+
+        return it->second;
+    }
+
+    const std::string &server::get_request_bus(const UUIDv4::UUID &request_id) const {
+        return get_vehicle_bus(vehicles.load()->request_vehicle_map.at(request_id));
+    }
+
+    obd2_bridge &server::get_request_bridge(const UUIDv4::UUID &request_id) {
+        auto it = bridges.find(get_request_bus(request_id));
+
+        // Buses that could not be set up fall back to the primary bus
+        if (it == bridges.end()) {
+            return *obd2;
+        }
+
+        return *it->second;
     }
 }
@@ -1,18 +1,37 @@
 #pragma once
 
 #include <chrono>
+#include <condition_variable>
 #include <cstdint>
+#include <deque>
 #include <httplib.h>
 #include <json.hpp>
+#include <mutex>
+#include <random>
 #include <string>
 #include <thread>
 
 #include "dashboard/dashboard.h"
 #include "data_log/data_log.h"
+#include "data_log/log_series/log_series.h"
+#include "metered_task_queue/metered_task_queue.h"
 #include "obd2_bridge/obd2_bridge.h"
+#include "response_cache/response_cache.h"
+#include "snapshot/snapshot.h"
 #include "vehicle/vehicle.h"
 
 namespace obd2_server {
+    // A CAN interface served by its own bridge, in addition to obd2_can_device
+    struct obd2_bus_config {
+        std::string can_device;
+        uint32_t can_bitrate;
+        uint32_t refresh_ms;
+        bool use_pid_chaining;
+        bool skip_can_setup;
+        bool bitrate_discovery;
+        std::vector<UUIDv4::UUID> vehicles; // Requests of these vehicles are routed to this bus
+    };
+
     class server {
         public:
             static const std::string DEFAULT_OBD2_CAN_DEVICE;
@@ -21,14 +40,29 @@ namespace obd2_server {
             static const bool DEFAULT_OBD2_USE_PID_CHAINING;
             static const bool DEFAULT_OBD2_SKIP_CAN_SETUP;
             static const bool DEFAULT_OBD2_BITRATE_DISCOVERY;
+            static const uint32_t DEFAULT_OBD2_REQUEST_TTL_MS;
 
             static const std::string DEFAULT_SERVER_ADDRESS;
             static const uint16_t DEFAULT_SERVER_PORT;
+            static const uint32_t DEFAULT_SERVER_THREADS;
+            static const uint32_t DEFAULT_SERVER_LONG_POLL_THREADS;
+            static const uint32_t DEFAULT_SERVER_KEEP_ALIVE_MAX_COUNT;
+            static const uint32_t DEFAULT_SERVER_KEEP_ALIVE_TIMEOUT_S;
+
+            static const uint32_t DEFAULT_LOG_FLUSH_INTERVAL_MS;
+            static const bool DEFAULT_LOG_FSYNC;
+            static const log_format DEFAULT_LOG_FORMAT;
+            static const uint64_t DEFAULT_LOG_SEGMENT_MAX_BYTES;
+            static const uint32_t DEFAULT_LOG_SEGMENT_MAX_S;
+            static const bool DEFAULT_LOG_COMPRESS;
+            static const uint64_t DEFAULT_LOG_RETENTION_MAX_BYTES;
+            static const uint32_t DEFAULT_LOG_RETENTION_MAX_AGE_S;
 
             static const std::string DEFAULT_CONFIG_PATH;
             static const std::string DEFAULT_DASHBOARDS_DIR;
             static const std::string DEFAULT_VEHICLES_DIR;
             static const std::string DEFAULT_LOGS_DIR;
+            static const std::string DEFAULT_SUPPORT_CACHE_DIR;
             
             server();
             server(std::string server_config);
@@ -50,12 +84,27 @@ namespace obd2_server {
             void set_obd2_use_pid_chaining(bool use_pid_chaining);
             void set_obd2_bitrate_discovery(bool bitrate_discovery);
             void set_obd2_skip_can_setup(bool skip_can_setup);
+            void set_obd2_request_ttl_ms(uint32_t ttl_ms);
+            void set_obd2_buses(const std::vector<obd2_bus_config> &buses);
             void set_server_address(const std::string &address);
             void set_server_port(uint16_t port);
+            void set_server_threads(uint32_t threads);
+            void set_server_long_poll_threads(uint32_t threads);
+            void set_server_keep_alive_max_count(uint32_t count);
+            void set_server_keep_alive_timeout_s(uint32_t timeout_s);
+            void set_log_flush_interval_ms(uint32_t interval_ms);
+            void set_log_fsync(bool fsync);
+            void set_log_format(log_format format);
+            void set_log_segment_max_bytes(uint64_t max_bytes);
+            void set_log_segment_max_s(uint32_t max_s);
+            void set_log_compress(bool compress);
+            void set_log_retention_max_bytes(uint64_t max_bytes);
+            void set_log_retention_max_age_s(uint32_t max_age_s);
             void set_config_path(const std::string &path);
             void set_dashboards_dir(const std::string &path);
             void set_vehicles_dir(const std::string &path);
             void set_logs_dir(const std::string &path);
+            void set_support_cache_dir(const std::string &path);
 
             const std::string &get_obd2_can_device() const;
             uint32_t get_obd2_can_bitrate() const;
@@ -63,12 +112,27 @@ namespace obd2_server {
             bool get_obd2_use_pid_chaining() const;
             bool get_obd2_bitrate_discovery() const;
             bool get_obd2_skip_can_setup() const;
+            uint32_t get_obd2_request_ttl_ms() const;
+            const std::vector<obd2_bus_config> &get_obd2_buses() const;
             const std::string &get_server_address() const;
             uint16_t get_server_port() const;
+            uint32_t get_server_threads() const;
+            uint32_t get_server_long_poll_threads() const;
+            uint32_t get_server_keep_alive_max_count() const;
+            uint32_t get_server_keep_alive_timeout_s() const;
+            uint32_t get_log_flush_interval_ms() const;
+            bool get_log_fsync() const;
+            log_format get_log_format() const;
+            uint64_t get_log_segment_max_bytes() const;
+            uint32_t get_log_segment_max_s() const;
+            bool get_log_compress() const;
+            uint64_t get_log_retention_max_bytes() const;
+            uint32_t get_log_retention_max_age_s() const;
             std::string get_config_path() const;
             std::string get_dashboards_dir() const;
             std::string get_vehicles_dir() const;
             std::string get_logs_dir() const;
+            std::string get_support_cache_dir() const;
 
         private:
             std::string obd2_can_device = DEFAULT_OBD2_CAN_DEVICE;
@@ -77,42 +141,179 @@ namespace obd2_server {
             bool obd2_use_pid_chaining  = DEFAULT_OBD2_USE_PID_CHAINING;
             bool obd2_skip_can_setup    = DEFAULT_OBD2_SKIP_CAN_SETUP;
             bool obd2_bitrate_discovery = DEFAULT_OBD2_BITRATE_DISCOVERY;
+            uint32_t obd2_request_ttl_ms = DEFAULT_OBD2_REQUEST_TTL_MS;
+            std::vector<obd2_bus_config> obd2_buses;
 
             std::string server_address  = DEFAULT_SERVER_ADDRESS;
             uint16_t server_port        = DEFAULT_SERVER_PORT;
+            uint32_t server_threads     = DEFAULT_SERVER_THREADS;
+            uint32_t server_long_poll_threads = DEFAULT_SERVER_LONG_POLL_THREADS;
+            uint32_t server_keep_alive_max_count = DEFAULT_SERVER_KEEP_ALIVE_MAX_COUNT;
+            uint32_t server_keep_alive_timeout_s = DEFAULT_SERVER_KEEP_ALIVE_TIMEOUT_S;
+
+            std::atomic<uint32_t> log_flush_interval_ms = DEFAULT_LOG_FLUSH_INTERVAL_MS;
+            std::atomic<bool> log_fsync = DEFAULT_LOG_FSYNC;
+            log_format log_file_format = DEFAULT_LOG_FORMAT; // Format of new logs
+            std::atomic<uint64_t> log_segment_max_bytes = DEFAULT_LOG_SEGMENT_MAX_BYTES;    // 0 => Unlimited
+            std::atomic<uint32_t> log_segment_max_s = DEFAULT_LOG_SEGMENT_MAX_S;            // 0 => Unlimited
+            std::atomic<bool> log_compress = DEFAULT_LOG_COMPRESS;
+            std::atomic<uint64_t> log_retention_max_bytes = DEFAULT_LOG_RETENTION_MAX_BYTES; // 0 => Unlimited
+            std::atomic<uint32_t> log_retention_max_age_s = DEFAULT_LOG_RETENTION_MAX_AGE_S; // 0 => Unlimited
 
             std::string config_path     = DEFAULT_CONFIG_PATH;
             std::string dashboards_dir  = DEFAULT_DASHBOARDS_DIR;
             std::string vehicles_dir    = DEFAULT_VEHICLES_DIR;
             std::string logs_dir        = DEFAULT_LOGS_DIR;
+            std::string support_cache_dir = DEFAULT_SUPPORT_CACHE_DIR;
+
+            // Vehicle definitions together with the index of their requests, always replaced as a whole
+            struct vehicle_set {
+                std::unordered_map<UUIDv4::UUID, vehicle> vehicles;
+                std::unordered_map<UUIDv4::UUID, UUIDv4::UUID> request_vehicle_map; // Request ID => Vehicle ID
+            };
 
-            std::unordered_map<UUIDv4::UUID, vehicle> vehicles;
-            std::unordered_map<UUIDv4::UUID, dashboard> dashboards;
+            // HTTP workers and the refresh callbacks read these without locking, 
+            // writers publish a new version (see snapshot)
+            snapshot<vehicle_set> vehicles;
+            snapshot<std::unordered_map<UUIDv4::UUID, dashboard>> dashboards;
+            snapshot<std::unordered_map<std::string, std::shared_ptr<data_log>>> logs;
+            snapshot<std::unordered_map<std::string, std::string>> log_bus_map; // Log name => CAN device whose refresh samples it
             
-            std::unordered_map<UUIDv4::UUID, UUIDv4::UUID> request_vehicle_map; // Request ID => Vehicle ID
-            std::unordered_map<std::string, data_log> logs;
+            // Serialized bodies of GET /vehicles and GET /dashboards
+            response_cache vehicles_cache;
+            response_cache dashboards_cache;
+
+            std::unordered_map<UUIDv4::UUID, std::string> vehicle_bus_map; // Vehicle ID => CAN device, set up once
+
+            // Encodings of /data and /data/stream, negotiated through the Accept header
+            enum class data_encoding {
+                JSON,
+                CBOR,
+                MSGPACK,
+                PACKED  // Little-endian record count (uint16), then per record: index (uint16), 
+                        // flags (uint8, bit 0 = stale), reserved (uint8), value (float32), age in ms (uint32)
+            };
+
+            // A client of /data/stream, sent an update after every refresh of its bus
+            struct data_stream {
+                struct entry {
+                    UUIDv4::UUID id;
+                    obd2_bridge *bridge;
+                    size_t slot;
+                    float last_value;
+                    bool sent;
+                };
+
+                std::vector<entry> entries;
+                obd2_bridge *bridge; // Bus whose refreshes trigger updates
+                uint64_t epoch;
+                data_encoding encoding;
+            };
+
+            // An ID list resolved once by POST /subscriptions, so reads are a plain indexed gather
+            struct subscription {
+                std::vector<UUIDv4::UUID> ids;
+                std::vector<std::string> keys;      // IDs as JSON keys
+                std::vector<obd2_bridge *> bridges;
+                std::vector<size_t> slots;
+                obd2_bridge *bridge;                // Bus whose refreshes reads wait for
+                std::atomic<std::chrono::steady_clock::rep> last_used;
+            };
+
+            static const std::chrono::milliseconds STREAM_KEEPALIVE_INTERVAL;
+            static const std::chrono::milliseconds LONG_POLL_TIMEOUT;
+            static const size_t MAX_INLINE_LOG_SIZE;
+            static const size_t LOG_STREAM_CHUNK_SIZE;
+            static const std::chrono::milliseconds LOG_RETENTION_INTERVAL;
+            static const size_t LOG_RING_MIN_RECORDS;
+            static const size_t LOG_SERIES_DEFAULT_BUCKETS;
+            static const size_t LOG_SERIES_MAX_BUCKETS;
+            static const size_t LOG_SERIES_CACHE_SIZE;
+            static const std::chrono::milliseconds SUBSCRIPTION_TTL;
+            static const std::chrono::milliseconds SUBSCRIPTION_SWEEP_INTERVAL;
+
+            std::mutex subscriptions_mutex;
+            std::unordered_map<std::string, std::shared_ptr<subscription>> subscriptions; // Handle => Subscription
+            std::chrono::steady_clock::time_point last_subscription_sweep;
+            std::mt19937_64 subscription_rng{ std::random_device()() };
+
+            // Requests that wait for new data (long-polls and streams) may only occupy 
+            // server_long_poll_threads workers, so short requests always find a free one
+            task_queue_metrics http_metrics;
+            std::atomic<uint32_t> long_polls_active = 0;
+            std::atomic<uint64_t> long_polls_degraded = 0;
+            std::atomic<uint64_t> streams_rejected = 0;
+
+            // Drains the rows queued by the sampling threads into the log files, 
+            // so slow storage never delays a bus cycle
+            std::thread log_writer_thread;
+            std::atomic<bool> log_writer_running = false;
+            std::mutex log_writer_mutex;
+            std::condition_variable log_writer_cv;
+
+            // Compresses closed log segments, enforces the retention limits and expires idle subscriptions, 
+            // so none of it runs on the log writer or depends on bus traffic
+            std::thread log_maintenance_thread;
+            std::atomic<bool> log_maintenance_running = false;
+            std::mutex log_maintenance_mutex;
+            std::condition_variable log_maintenance_cv;
+            std::deque<std::string> pending_log_segments; // Closed segments waiting for compression
+
+            // Bodies of /logs/:name/series for stopped logs, which only change when retention prunes them. 
+            // The oldest entry is dropped first
+            std::mutex log_series_cache_mutex;
+            std::unordered_map<std::string, std::shared_ptr<const response_cache::entry>> log_series_cache;
+            std::deque<std::string> log_series_cache_order;
 
             httplib::Server server_instance;
-            std::unique_ptr<obd2_bridge> obd2;
+            std::unordered_map<std::string, std::unique_ptr<obd2_bridge>> bridges; // CAN device => Bridge
+            obd2_bridge *obd2 = nullptr; // Bridge of obd2_can_device
 
             bool load_server_config();
             uint32_t load_vehicles();
             uint32_t load_dashboards();
             uint32_t load_logs();
-            void create_req_vehicle_map();
+            void create_req_vehicle_map(vehicle_set &set) const;
 
             void save_server_config();
             void make_directories();
 
-            void handle_obd2_refresh();
-            void process_logs();
-            std::string create_log(const UUIDv4::UUID &dashboard_id, bool log_raw);
+            void create_bridges();
+            void add_bridge(const std::string &device, bool skip_can_setup, bool bitrate_discovery,
+                uint32_t bitrate, uint32_t refresh_ms, bool use_pid_chaining);
+            void handle_obd2_refresh(const std::string &bus);
+            void process_logs(const std::string &bus);
+            void log_writer_loop();
+            void write_logs();
+            void queue_log_segments(const std::vector<std::string> &paths);
+            void log_maintenance_loop();
+            void compress_log_segment(const std::string &path);
+            void apply_log_retention();
+            void remove_log_caches(const std::string &name);
+            void expire_subscriptions();
+            std::shared_ptr<subscription> find_subscription(const std::string &handle);
+            void release_subscription(const subscription &sub);
+            std::string create_log(const UUIDv4::UUID &dashboard_id, bool log_raw, log_format format);
+            std::string get_log_column_name(const request &r, bool log_raw) const;
             void stop_log(const std::string &name);
 
-            request &get_request(const UUIDv4::UUID &id);
+            std::shared_ptr<const request> get_request(const UUIDv4::UUID &id) const;
+            const std::string &get_vehicle_bus(const UUIDv4::UUID &vehicle_id) const;
+            const std::string &get_request_bus(const UUIDv4::UUID &request_id) const;
+            obd2_bridge &get_request_bridge(const UUIDv4::UUID &request_id);
+            obd2_bridge *get_selected_bridge(const httplib::Request &req, httplib::Response &res);
 
             void setup_routes();
+            void setup_http_workers();
+            bool try_begin_long_poll();
+            void end_long_poll();
+            bool await_long_poll(obd2_bridge &bridge, uint64_t &epoch); // False without waiting if the lane is full
+            void send_long_poll_busy(httplib::Response &res);
             void set_cors_headers(httplib::Response &res);
+            void send_cached(const httplib::Request &req, httplib::Response &res, const response_cache::entry &e);
+            void set_encoded_content(httplib::Response &res, const std::string &body, content_encoding encoding);
+            std::string get_compressed_log(const data_log &log, content_encoding encoding);
+            void send_log_file(const log_segment &segment, httplib::Response &res); // Memory-mapped, with Range support
             
             void handle_options(const httplib::Request &req, httplib::Response &res);
             void handle_get_vehicles(const httplib::Request &req, httplib::Response &res);
@@ -122,17 +323,33 @@ namespace obd2_server {
             void handle_put_dashboard(const httplib::Request &req, httplib::Response &res);
             void handle_delete_dashboard(const httplib::Request &req, httplib::Response &res);
             void handle_get_data(const httplib::Request &req, httplib::Response &res);
+            void handle_get_data_stream(const httplib::Request &req, httplib::Response &res);
+            void handle_get_subscription_data(const httplib::Request &req, httplib::Response &res);
+            void handle_post_subscription(const httplib::Request &req, httplib::Response &res);
+            void handle_delete_subscription(const httplib::Request &req, httplib::Response &res);
             void handle_get_dtcs(const httplib::Request &req, httplib::Response &res);
             void handle_delete_dtcs(const httplib::Request &req, httplib::Response &res);
             void handle_get_log(const httplib::Request &req, httplib::Response &res);
+            void handle_get_log_raw(const httplib::Request &req, httplib::Response &res);
+            void handle_get_log_csv(const httplib::Request &req, httplib::Response &res);
+            void handle_get_log_series(const httplib::Request &req, httplib::Response &res);
             void handle_post_log(const httplib::Request &req, httplib::Response &res);
             void handle_get_config(const httplib::Request &req, httplib::Response &res);
             void handle_put_config(const httplib::Request &req, httplib::Response &res);
             void handle_get_status(const httplib::Request &req, httplib::Response &res);
 
             std::vector<UUIDv4::UUID> split_ids(const std::string &s, char delim);
-            std::unordered_map<UUIDv4::UUID, float> get_data_for_ids(const std::vector<UUIDv4::UUID> &ids, bool await_new_data = false);
-            std::unordered_map<UUIDv4::UUID, std::vector<uint8_t>> get_raw_data_for_ids(const std::vector<UUIDv4::UUID> &ids);
+            data_encoding get_data_encoding(const httplib::Request &req) const;
+            std::string get_data_content_type(data_encoding encoding) const;
+            std::string encode_data(const std::vector<std::pair<uint16_t, value_sample>> &samples, 
+                data_encoding encoding) const;
+            nlohmann::json get_samples_json(const std::vector<std::pair<uint16_t, value_sample>> &samples, 
+                const std::vector<std::string> &keys, bool with_age) const;
+            void send_data_since(const httplib::Request &req, httplib::Response &res, 
+                const std::vector<obd2_bridge *> &slot_bridges, const std::vector<size_t> &slots, 
+                const std::vector<std::string> &keys, obd2_bridge &bridge);
+            bool get_data_for_ids(const std::vector<UUIDv4::UUID> &ids, // False if awaiting new data was refused
+                std::unordered_map<UUIDv4::UUID, value_sample> &data, bool await_new_data = false, obd2_bridge *bridge = nullptr);
             std::string expand_path(const std::string &path) const;
 
             friend void to_json(nlohmann::json& j, const server& s);
@@ -142,5 +359,9 @@ namespace obd2_server {
     void to_json(nlohmann::json& j, const server& s);
     void from_json(const nlohmann::json& j, server& s);
 
+    void to_json(nlohmann::json& j, const obd2_bus_config& b);
+    void from_json(const nlohmann::json& j, obd2_bus_config& b);
+
     void to_json(nlohmann::json& j, const std::unordered_map<UUIDv4::UUID, float>& d);
+    void to_json(nlohmann::json& j, const std::unordered_map<UUIDv4::UUID, value_sample>& d);
 }
\ No newline at end of file
@@ -9,14 +9,29 @@ namespace obd2_server {
     const bool server::DEFAULT_OBD2_USE_PID_CHAINING    = false;
     const bool server::DEFAULT_OBD2_SKIP_CAN_SETUP      = false;
     const bool server::DEFAULT_OBD2_BITRATE_DISCOVERY   = true;
+    const uint32_t server::DEFAULT_OBD2_REQUEST_TTL_MS  = 30000;
 
     const std::string server::DEFAULT_SERVER_ADDRESS    = "0.0.0.0";
     const uint16_t server::DEFAULT_SERVER_PORT          = 38380;
+    const uint32_t server::DEFAULT_SERVER_THREADS       = 8;
+    const uint32_t server::DEFAULT_SERVER_LONG_POLL_THREADS     = 4;
+    const uint32_t server::DEFAULT_SERVER_KEEP_ALIVE_MAX_COUNT  = 100;
+    const uint32_t server::DEFAULT_SERVER_KEEP_ALIVE_TIMEOUT_S  = 5;
+
+    const uint32_t server::DEFAULT_LOG_FLUSH_INTERVAL_MS    = 500;
+    const bool server::DEFAULT_LOG_FSYNC                    = false;
+    const log_format server::DEFAULT_LOG_FORMAT             = log_format::BINARY;
+    const uint64_t server::DEFAULT_LOG_SEGMENT_MAX_BYTES    = 16 * 1024 * 1024;
+    const uint32_t server::DEFAULT_LOG_SEGMENT_MAX_S        = 3600;
+    const bool server::DEFAULT_LOG_COMPRESS                 = true;
+    const uint64_t server::DEFAULT_LOG_RETENTION_MAX_BYTES  = 2ull * 1024 * 1024 * 1024;
+    const uint32_t server::DEFAULT_LOG_RETENTION_MAX_AGE_S  = 0;
 
     const std::string server::DEFAULT_CONFIG_PATH       = "$HOME/.config/obd2-server/config.json";
     const std::string server::DEFAULT_DASHBOARDS_DIR    = "$HOME/.config/obd2-server/dashboards";
     const std::string server::DEFAULT_VEHICLES_DIR      = "$HOME/.config/obd2-server/vehicles";
     const std::string server::DEFAULT_LOGS_DIR          = "$HOME/.config/obd2-server/logs";
+    const std::string server::DEFAULT_SUPPORT_CACHE_DIR = "$HOME/.config/obd2-server/support";
 
     bool server::load_server_config() {
         std::ifstream file(get_config_path());
@@ -46,7 +61,7 @@ namespace obd2_server {
             return 0;
         }
 
-        vehicles.clear();
+        vehicle_set set;
 
         // Iterate through all files in the vehicles directory and load .json files
         for (const auto& entry : std::filesystem::directory_iterator(path)) {
@@ -60,16 +75,20 @@ namespace obd2_server {
 
             try {
                 vehicle v(entry.path().string());
-                vehicles.try_emplace(v.get_id(), v);
+                set.vehicles.try_emplace(v.get_id(), v);
             }
             catch (std::exception &e) {
                 std::cerr << "Could not load vehicle from " << entry.path().string() << ": " << e.what() << std::endl;
             }
         }
 
-        create_req_vehicle_map();
+        create_req_vehicle_map(set);
 
-        return vehicles.size();
+        uint32_t count = set.vehicles.size();
+        vehicles.store(std::move(set));
+        vehicles_cache.invalidate();
+
+        return count;
     }
 
     uint32_t server::load_dashboards() {
@@ -79,7 +98,7 @@ namespace obd2_server {
             return 0;
         }
 
-        dashboards.clear();
+        std::unordered_map<UUIDv4::UUID, dashboard> loaded;
 
         // Iterate through all files in the dashboard directory and load .json files
         for (const auto& entry : std::filesystem::directory_iterator(path)) {
@@ -93,14 +112,18 @@ namespace obd2_server {
 
             try {
                 dashboard d(entry.path().string());
-                dashboards.try_emplace(d.get_id(), std::move(d));
+                loaded.try_emplace(d.get_id(), std::move(d));
             }
             catch (std::exception &e) {
                 std::cerr << "Could not load dashboard from " << entry.path().string() << ": " << e.what() << std::endl;
             }
         }
 
-        return dashboards.size();
+        uint32_t count = loaded.size();
+        dashboards.store(std::move(loaded));
+        dashboards_cache.invalidate();
+
+        return count;
     }
 
     uint32_t server::load_logs() {
@@ -110,33 +133,75 @@ namespace obd2_server {
             return 0;
         }
 
-        logs.clear();
+        std::unordered_map<std::string, std::shared_ptr<data_log>> loaded;
+        std::unordered_map<std::string, std::pair<log_format, uint32_t>> found; // Log name => Format, segment count
 
-        // Iterate through all files in the logs directory and add loggers
+        // Iterate through all files in the logs directory and collect the segments of each log (see log_segment)
         for (const auto& entry : std::filesystem::directory_iterator(path)) {
             if (!entry.is_regular_file()) {
                 continue;
             }
 
-            if (entry.path().extension() != ".csv") {
+            std::filesystem::path segment_path = entry.path().filename();
+
+            if (segment_path.extension() == get_file_extension(data_log::SEGMENT_ENCODING)) {
+                segment_path = segment_path.stem();
+            }
+
+            std::string extension = segment_path.extension().string();
+
+            if (extension != ".csv" && extension != ".bin") {
+                continue;
+            }
+
+            segment_path = segment_path.stem();
+
+            std::string name = segment_path.stem().string();
+            std::string index = segment_path.has_extension() ? segment_path.extension().string().substr(1) : "0";
+
+            if (index.empty() || index.size() > 9 || index.find_first_not_of("0123456789") != std::string::npos) {
                 continue;
             }
-            
-            std::string name = entry.path().filename().replace_extension("").string();
-            logs.try_emplace(name, name, path.string());
+
+            auto &log = found.try_emplace(name, obd2_server::get_log_format(extension), 0).first->second;
+            log.second = std::max<uint32_t>(log.second, std::stoul(index) + 1);
+        }
+
+        for (const auto &log : found) {
+            // Binary logs are checked on load, a truncated header would fail every later read
+            try {
+                auto loaded_log = std::make_shared<data_log>(log.first, path.string(), log.second.first, log.second.second);
+                std::vector<std::string> uncompressed;
+
+                // Logs are never running at startup, segments missed by the last run are compressed now
+                for (const log_segment &segment : loaded_log->get_segments()) {
+                    if (segment.encoding == content_encoding::NONE) {
+                        uncompressed.push_back(segment.path);
+                    }
+                }
+
+                loaded.try_emplace(log.first, loaded_log);
+                queue_log_segments(uncompressed);
+            }
+            catch (const std::exception &e) {
+                std::cerr << "Could not load log " << log.first << ": " << e.what() << std::endl;
+            }
         }
 
-        return logs.size();
+        uint32_t count = loaded.size();
+        logs.store(std::move(loaded));
+
+        return count;
     }
 
-    void server::create_req_vehicle_map() {
-        request_vehicle_map.clear();
+    void server::create_req_vehicle_map(vehicle_set &set) const {
+        set.request_vehicle_map.clear();
 
-        for (auto &v : vehicles) {
+        for (const auto &v : set.vehicles) {
             const auto &requests = v.second.get_requests();
 
             for (const auto &r : requests) {
-                request_vehicle_map[r.id] = v.second.get_id();
+                set.request_vehicle_map[r.id] = v.second.get_id();
             }
         }
     }
@@ -160,6 +225,7 @@ namespace obd2_server {
         std::filesystem::create_directories(get_dashboards_dir());
         std::filesystem::create_directories(get_vehicles_dir());
         std::filesystem::create_directories(get_logs_dir());
+        std::filesystem::create_directories(get_support_cache_dir());
     }
 
     std::string server::expand_path(const std::string &path) const {
@@ -193,14 +259,29 @@ namespace obd2_server {
             {"obd2_can_bitrate", s.get_obd2_can_bitrate()},
             {"obd2_refresh_ms", s.get_obd2_refresh_ms()},
             {"obd2_bitrate_discovery", s.get_obd2_bitrate_discovery()},
-            // {"obd2_use_pid_chaining", s.get_obd2_use_pid_chaining()},
+            {"obd2_use_pid_chaining", s.get_obd2_use_pid_chaining()},
             {"obd2_skip_can_setup", s.get_obd2_skip_can_setup()},
+            {"obd2_request_ttl_ms", s.get_obd2_request_ttl_ms()},
+            {"obd2_buses", s.get_obd2_buses()},
             {"server_address", s.get_server_address()},
             {"server_port", s.get_server_port()},
+            {"server_threads", s.get_server_threads()},
+            {"server_long_poll_threads", s.get_server_long_poll_threads()},
+            {"server_keep_alive_max_count", s.get_server_keep_alive_max_count()},
+            {"server_keep_alive_timeout_s", s.get_server_keep_alive_timeout_s()},
+            {"log_flush_interval_ms", s.get_log_flush_interval_ms()},
+            {"log_format", s.get_log_format()},
+            {"log_fsync", s.get_log_fsync()},
+            {"log_segment_max_bytes", s.get_log_segment_max_bytes()},
+            {"log_segment_max_s", s.get_log_segment_max_s()},
+            {"log_compress", s.get_log_compress()},
+            {"log_retention_max_bytes", s.get_log_retention_max_bytes()},
+            {"log_retention_max_age_s", s.get_log_retention_max_age_s()},
             {"config_path", s.config_path},
             {"dashboards_dir", s.dashboards_dir},
             {"vehicles_dir", s.vehicles_dir},
-            {"logs_dir", s.logs_dir}
+            {"logs_dir", s.logs_dir},
+            {"support_cache_dir", s.support_cache_dir}
         };
     }
 
@@ -223,14 +304,22 @@ namespace obd2_server {
             s.set_obd2_bitrate_discovery(json_it->template get<bool>());
         }
 
-        // if ((json_it = j.find("obd2_use_pid_chaining")) != j.end()) {
-        //     s.set_obd2_use_pid_chaining(json_it->template get<bool>());
-        // }
+        if ((json_it = j.find("obd2_use_pid_chaining")) != j.end()) {
+            s.set_obd2_use_pid_chaining(json_it->template get<bool>());
+        }
 
         if ((json_it = j.find("obd2_skip_can_setup")) != j.end()) {
             s.set_obd2_skip_can_setup(json_it->template get<bool>());
         }
 
+        if ((json_it = j.find("obd2_request_ttl_ms")) != j.end()) {
+            s.set_obd2_request_ttl_ms(json_it->template get<uint32_t>());
+        }
+
+        if ((json_it = j.find("obd2_buses")) != j.end()) {
+            s.set_obd2_buses(json_it->template get<std::vector<obd2_bus_config>>());
+        }
+
         if ((json_it = j.find("server_address")) != j.end()) {
             s.set_server_address(json_it->template get<std::string>());
         }
@@ -239,6 +328,54 @@ namespace obd2_server {
             s.set_server_port(json_it->template get<uint16_t>());
         }
 
+        if ((json_it = j.find("server_threads")) != j.end()) {
+            s.set_server_threads(json_it->template get<uint32_t>());
+        }
+
+        if ((json_it = j.find("server_long_poll_threads")) != j.end()) {
+            s.set_server_long_poll_threads(json_it->template get<uint32_t>());
+        }
+
+        if ((json_it = j.find("server_keep_alive_max_count")) != j.end()) {
+            s.set_server_keep_alive_max_count(json_it->template get<uint32_t>());
+        }
+
+        if ((json_it = j.find("server_keep_alive_timeout_s")) != j.end()) {
+            s.set_server_keep_alive_timeout_s(json_it->template get<uint32_t>());
+        }
+
+        if ((json_it = j.find("log_flush_interval_ms")) != j.end()) {
+            s.set_log_flush_interval_ms(json_it->template get<uint32_t>());
+        }
+
+        if ((json_it = j.find("log_fsync")) != j.end()) {
+            s.set_log_fsync(json_it->template get<bool>());
+        }
+
+        if ((json_it = j.find("log_format")) != j.end()) {
+            s.set_log_format(json_it->template get<log_format>());
+        }
+
+        if ((json_it = j.find("log_segment_max_bytes")) != j.end()) {
+            s.set_log_segment_max_bytes(json_it->template get<uint64_t>());
+        }
+
+        if ((json_it = j.find("log_segment_max_s")) != j.end()) {
+            s.set_log_segment_max_s(json_it->template get<uint32_t>());
+        }
+
+        if ((json_it = j.find("log_compress")) != j.end()) {
+            s.set_log_compress(json_it->template get<bool>());
+        }
+
+        if ((json_it = j.find("log_retention_max_bytes")) != j.end()) {
+            s.set_log_retention_max_bytes(json_it->template get<uint64_t>());
+        }
+
+        if ((json_it = j.find("log_retention_max_age_s")) != j.end()) {
+            s.set_log_retention_max_age_s(json_it->template get<uint32_t>());
+        }
+
         if ((json_it = j.find("config_path")) != j.end()) {
             s.set_config_path(json_it->template get<std::string>());
         }
@@ -254,5 +391,32 @@ namespace obd2_server {
         if ((json_it = j.find("logs_dir")) != j.end()) {
             s.set_logs_dir(json_it->template get<std::string>());
         }
+
+        if ((json_it = j.find("support_cache_dir")) != j.end()) {
+            s.set_support_cache_dir(json_it->template get<std::string>());
+        }
+    }
+
+    void to_json(nlohmann::json& j, const obd2_bus_config& b) {
+        j = nlohmann::json{
+            {"can_device", b.can_device},
+            {"can_bitrate", b.can_bitrate},
+            {"refresh_ms", b.refresh_ms},
+            {"use_pid_chaining", b.use_pid_chaining},
+            {"skip_can_setup", b.skip_can_setup},
+            {"bitrate_discovery", b.bitrate_discovery},
+            {"vehicles", b.vehicles}
+        };
+    }
+
+    void from_json(const nlohmann::json& j, obd2_bus_config& b) {
+        // Everything but the device is optional and defaults like the primary bus
+        b.can_device = j.at("can_device").template get<std::string>();
+        b.can_bitrate = j.value("can_bitrate", server::DEFAULT_OBD2_CAN_BITRATE);
+        b.refresh_ms = j.value("refresh_ms", server::DEFAULT_OBD2_REFRESH_MS);
+        b.use_pid_chaining = j.value("use_pid_chaining", server::DEFAULT_OBD2_USE_PID_CHAINING);
+        b.skip_can_setup = j.value("skip_can_setup", server::DEFAULT_OBD2_SKIP_CAN_SETUP);
+        b.bitrate_discovery = j.value("bitrate_discovery", server::DEFAULT_OBD2_BITRATE_DISCOVERY);
+        b.vehicles = j.value("vehicles", std::vector<UUIDv4::UUID>());
     }
-}
+}
\ No newline at end of file
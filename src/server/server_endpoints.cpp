@@ -1,6 +1,25 @@
 #include "server.h"
 
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 namespace obd2_server {
+    const std::chrono::milliseconds server::STREAM_KEEPALIVE_INTERVAL = std::chrono::milliseconds(15000);
+    const std::chrono::milliseconds server::LONG_POLL_TIMEOUT = std::chrono::milliseconds(5000);
+    const size_t server::MAX_INLINE_LOG_SIZE = 8 * 1024 * 1024;
+    const size_t server::LOG_STREAM_CHUNK_SIZE = 64 * 1024;
+    const std::chrono::milliseconds server::LOG_RETENTION_INTERVAL = std::chrono::milliseconds(60000);
+    const size_t server::LOG_RING_MIN_RECORDS = 64;
+    const size_t server::LOG_SERIES_DEFAULT_BUCKETS = 100;
+    const size_t server::LOG_SERIES_MAX_BUCKETS = 1000;
+    const size_t server::LOG_SERIES_CACHE_SIZE = 64;
+    const std::chrono::milliseconds server::SUBSCRIPTION_TTL = std::chrono::milliseconds(60000);
+    const std::chrono::milliseconds server::SUBSCRIPTION_SWEEP_INTERVAL = std::chrono::milliseconds(1000);
+
     void server::setup_routes() {
         server_instance.Get(
             "/vehicles", 
@@ -78,6 +97,40 @@ namespace obd2_server {
             )
         );
 
+        server_instance.Get(
+            "/data/stream",
+            std::bind(
+                &server::handle_get_data_stream,
+                this,
+                std::placeholders::_1,
+                std::placeholders::_2
+            )
+        );
+
+        server_instance.Post(
+            "/subscriptions",
+            httplib::Server::Handler(
+                std::bind(
+                    &server::handle_post_subscription,
+                    this,
+                    std::placeholders::_1,
+                    std::placeholders::_2
+                )
+            )
+        );
+
+        server_instance.Delete(
+            "/subscriptions/:handle",
+            httplib::Server::Handler(
+                std::bind(
+                    &server::handle_delete_subscription,
+                    this,
+                    std::placeholders::_1,
+                    std::placeholders::_2
+                )
+            )
+        );
+
         server_instance.Get(
             "/dtcs",
             std::bind(
@@ -110,6 +163,36 @@ namespace obd2_server {
             )
         );
 
+        server_instance.Get(
+            "/logs/:name/raw",
+            std::bind(
+                &server::handle_get_log_raw,
+                this,
+                std::placeholders::_1,
+                std::placeholders::_2
+            )
+        );
+
+        server_instance.Get(
+            "/logs/:name/csv",
+            std::bind(
+                &server::handle_get_log_csv,
+                this,
+                std::placeholders::_1,
+                std::placeholders::_2
+            )
+        );
+
+        server_instance.Get(
+            "/logs/:name/series",
+            std::bind(
+                &server::handle_get_log_series,
+                this,
+                std::placeholders::_1,
+                std::placeholders::_2
+            )
+        );
+
         server_instance.Post(
             "/logs",
             httplib::Server::Handler(
@@ -174,6 +257,67 @@ namespace obd2_server {
         res.set_header("Access-Control-Allow-Private-Network", "true");
     }
 
+    void server::send_cached(const httplib::Request &req, httplib::Response &res, const response_cache::entry &e) {
+        content_encoding encoding = select_content_encoding(req.get_header_value("Accept-Encoding"));
+
+        res.set_header("ETag", e.etag);
+        res.set_header("Vary", "Accept-Encoding");
+
+        // The client already has this version
+        if (req.get_header_value("If-None-Match") == e.etag) {
+            res.status = 304;
+            return;
+        }
+
+        set_encoded_content(res, e.get_body(encoding), encoding);
+    }
+
+    void server::set_encoded_content(httplib::Response &res, const std::string &body, content_encoding encoding) {
+        if (encoding != content_encoding::NONE) {
+            res.set_header("Content-Encoding", get_content_encoding_name(encoding));
+        }
+
+        res.set_content(body, "application/json");
+    }
+
+    std::string server::get_compressed_log(const data_log &log, content_encoding encoding) {
+        const std::string path = get_logs_dir() + "/" + log.get_name() + ".json." 
+            + (encoding == content_encoding::GZIP ? "gz" : "br");
+        std::ifstream cached(path, std::ios::binary);
+
+        if (cached.is_open()) {
+            std::stringstream ss;
+            ss << cached.rdbuf();
+            return ss.str();
+        }
+
+        nlohmann::json j = log;
+        j["data"] = log.get_csv_string();
+
+        std::string compressed = compress(j.dump(), encoding);
+
+        // Every writer has its own temporary file, which is renamed into place once complete. 
+        // Concurrent first downloads of a log then never read a partial file, the last rename wins
+        const std::string tmp_path = path + "." 
+            + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id())) + ".tmp";
+        std::ofstream out(tmp_path, std::ios::binary | std::ios::trunc);
+        out.write(compressed.data(), compressed.size());
+        out.close();
+
+        std::error_code ec;
+
+        if (out.good()) {
+            std::filesystem::rename(tmp_path, path, ec);
+        }
+
+        // The cache is only an optimization, the download is answered from memory either way
+        if (!out.good() || ec) {
+            std::filesystem::remove(tmp_path, ec);
+        }
+
+        return compressed;
+    }
+
     void server::handle_options(const httplib::Request &req, httplib::Response &res) {
         set_cors_headers(res);
         res.status = 204;
@@ -183,6 +327,7 @@ namespace obd2_server {
         set_cors_headers(res);
 
         nlohmann::json j = nlohmann::json::array();
+        auto set = vehicles.load();
 
         // Get request IDs from query
         auto params_it = req.params.find("requests");
@@ -193,10 +338,10 @@ namespace obd2_server {
             // Get info about requests
             for (const auto &id : req_ids) {
                 try {
-                    request &r = get_request(id);
-                    nlohmann::json req_j = r;
+                    const UUIDv4::UUID &vehicle_id = set->request_vehicle_map.at(id);
+                    nlohmann::json req_j = set->vehicles.at(vehicle_id).get_request(id);
 
-                    req_j["vehicle_id"] = request_vehicle_map.at(id);
+                    req_j["vehicle_id"] = vehicle_id;
 
                     j.push_back(req_j);
                 }
@@ -209,33 +354,58 @@ namespace obd2_server {
             return;
         }
         
-        // Go through all vehicles in map and add them to the JSON array
-        for (const auto &vehicle : vehicles) {
-            const std::vector<UUIDv4::UUID> &supported_requests = obd2->supported_requests(vehicle.second.get_requests());
-            nlohmann::json vehicle_j = vehicle.second;
-            vehicle_j["supported_requests"] = supported_requests;
-            
-            j.push_back(vehicle_j);
+        // Supported requests change with the connection, so they are part of the cache key
+        std::unordered_map<UUIDv4::UUID, std::vector<UUIDv4::UUID>> supported;
+        uint64_t key = 0;
+
+        for (const auto &vehicle : set->vehicles) {
+            auto bridge_it = bridges.find(get_vehicle_bus(vehicle.first));
+            obd2_bridge &bridge = bridge_it != bridges.end() ? *bridge_it->second : *obd2;
+            auto &supported_requests = supported[vehicle.first];
+
+            supported_requests = bridge.supported_requests(vehicle.second.get_requests());
+
+            for (const auto &id : supported_requests) {
+                key = key * 31 + std::hash<UUIDv4::UUID>()(id);
+            }
         }
 
-        res.set_content(j.dump(), "application/json");
+        auto cached = vehicles_cache.get([&set, &supported]() {
+            nlohmann::json j = nlohmann::json::array();
+
+            // Go through all vehicles in map and add them to the JSON array
+            for (const auto &vehicle : set->vehicles) {
+                nlohmann::json vehicle_j = vehicle.second;
+                vehicle_j["supported_requests"] = supported.at(vehicle.first);
+                
+                j.push_back(vehicle_j);
+            }
+
+            return j.dump();
+        }, key);
+
+        send_cached(req, res, *cached);
     }
 
     void server::handle_get_dashboards(const httplib::Request &req, httplib::Response &res) {
         set_cors_headers(res);
 
-        nlohmann::json j = nlohmann::json::array();
+        auto cached = dashboards_cache.get([this]() {
+            nlohmann::json j = nlohmann::json::array();
 
-        // Go through all dashboards in map and add them to the JSON array
-        for (const auto &dashboard : dashboards) {
-            nlohmann::json dashboard_j;
+            // Go through all dashboards in map and add them to the JSON array
+            for (const auto &dashboard : *dashboards.load()) {
+                nlohmann::json dashboard_j;
 
-            to_json(dashboard_j, dashboard.second);
+                to_json(dashboard_j, dashboard.second);
 
-            j.push_back(dashboard_j);
-        }
+                j.push_back(dashboard_j);
+            }
 
-        res.set_content(j.dump(), "application/json");
+            return j.dump();
+        });
+
+        send_cached(req, res, *cached);
     }
 
     void server::handle_get_dashboard_by_id(const httplib::Request &req, httplib::Response &res) {
@@ -254,9 +424,10 @@ namespace obd2_server {
 
         // Find specified dashboard
         UUIDv4::UUID id = UUIDv4::UUID::fromStrFactory(it_path->second);
-        auto it_dashboard = dashboards.find(id);
+        auto current = dashboards.load();
+        auto it_dashboard = current->find(id);
 
-        if (it_dashboard == dashboards.end()) {
+        if (it_dashboard == current->end()) {
             res_body["error"] = "Dashboard not found";
             res.status = 404;
             res.set_content(res_body.dump(), "application/json");
@@ -306,7 +477,10 @@ namespace obd2_server {
             return;
         }
 
-        dashboards.try_emplace(id, std::move(d));
+        dashboards.update([&](auto &current) {
+            current.try_emplace(id, std::move(d));
+        });
+        dashboards_cache.invalidate();
 
         res_body["id"] = id;
         res.set_content(res_body.dump(), "application/json");
@@ -335,22 +509,24 @@ namespace obd2_server {
             return;
         }
 
-        // Check if dashboard exists
         id = UUIDv4::UUID::fromStrFactory(it_id->second);
-        auto it_dashboard = dashboards.find(id);
+        bool found = false;
 
-        if (it_dashboard == dashboards.end()) {
-            res_body["error"] = "Dashboard not found";
-            res.status = 404;
-            res.set_content(res_body.dump(), "application/json");
-            return;
-        }
+        // Update a copy, readers keep seeing the old version until it is saved
+        try {
+            found = dashboards.update([&](auto &current) {
+                auto it_dashboard = current.find(id);
+
+                if (it_dashboard == current.end()) {
+                    return false;
+                }
 
-        dashboard &sel_dashboard = it_dashboard->second;
+                it_dashboard->second.update(update_body);
+                it_dashboard->second.save();
+                res_body = it_dashboard->second;
 
-        try {
-            sel_dashboard.update(update_body);
-            sel_dashboard.save();
+                return true;
+            });
         }
         catch (const std::exception &e) {
             res_body["error"] = e.what();
@@ -359,7 +535,14 @@ namespace obd2_server {
             return;
         }
 
-        res_body = sel_dashboard;
+        if (!found) {
+            res_body["error"] = "Dashboard not found";
+            res.status = 404;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        dashboards_cache.invalidate();
         res.set_content(res_body.dump(), "application/json");
     }
 
@@ -379,22 +562,30 @@ namespace obd2_server {
             return;
         }
 
-        // Check if dashboard exists
+        // Check if dashboard exists and delete it
         id = UUIDv4::UUID::fromStrFactory(it_id->second);
-        auto it_dashboard = dashboards.find(id);
 
-        if (it_dashboard == dashboards.end()) {
+        bool found = dashboards.update([&](auto &current) {
+            auto it_dashboard = current.find(id);
+
+            if (it_dashboard == current.end()) {
+                return false;
+            }
+
+            it_dashboard->second.delete_file();
+            current.erase(it_dashboard);
+
+            return true;
+        });
+
+        if (!found) {
             res_body["error"] = "Dashboard not found";
             res.status = 404;
             res.set_content(res_body.dump(), "application/json");
             return;
         }
 
-        // Delete dashboard
-        dashboard &sel_dashboard = it_dashboard->second;
-
-        sel_dashboard.delete_file();
-        dashboards.erase(id);
+        dashboards_cache.invalidate();
 
         res.status = 204;
     }
@@ -404,175 +595,983 @@ namespace obd2_server {
 
         nlohmann::json j;
         std::vector<UUIDv4::UUID> ids;
-        std::unordered_map<UUIDv4::UUID, float> data;
+        std::unordered_map<UUIDv4::UUID, value_sample> data;
         auto first_it = req.params.find("id");
 
+        if (req.has_param("sub")) {
+            handle_get_subscription_data(req, res);
+            return;
+        }
+
         if (first_it == req.params.end()) {
             j["error"] = "Missing parameter 'id'";
             res.status = 400;
             res.set_content(j.dump(), "application/json");
             return;
         }
+
+        // Without a bus selector, every request is read from the bus of its vehicle
+        obd2_bridge *bridge = nullptr;
+
+        if (req.has_param("bus") && (bridge = get_selected_bridge(req, res)) == nullptr) {
+            return;
+        }
         
         ids = split_ids(first_it->second, ',');
-        data = get_data_for_ids(ids, true);
-        to_json(j, data);
-
-        res.set_content(j.dump(), "application/json");
-    }
 
-    void server::handle_get_dtcs(const httplib::Request &req, httplib::Response &res) {
-        set_cors_headers(res);
+        // With since, only values that changed after that epoch are returned
+        if (req.has_param("since")) {
+            std::vector<obd2_bridge *> slot_bridges;
+            std::vector<size_t> slots;
+            std::vector<std::string> keys;
 
-        auto dtcs = obd2->get_dtcs();   
-        nlohmann::json j = dtcs;
+            for (const auto &id : ids) {
+                obd2_bridge &b = bridge ? *bridge : get_request_bridge(id);
 
-        res.set_content(j.dump(), "application/json");
-    }
+                if (!b.request_registered(id)) {
+                    b.register_request(*get_request(id));
+                }
 
-    void server::handle_delete_dtcs(const httplib::Request &req, httplib::Response &res) {
-        set_cors_headers(res);
+                slot_bridges.push_back(&b);
+                slots.push_back(b.get_request_slot(id));
+                keys.push_back(id.str());
+            }
 
-        obd2->clear_dtcs();
-        res.status = 204;
-    }
+            // Epochs are counted per bus, the first request's bus sets the pace
+            obd2_bridge &epoch_bridge = bridge ? *bridge : (slot_bridges.empty() ? *obd2 : *slot_bridges.front());
+            send_data_since(req, res, slot_bridges, slots, keys, epoch_bridge);
+            return;
+        }
 
-    void server::handle_get_log(const httplib::Request &req, httplib::Response &res) {
-        set_cors_headers(res);
+        if (!get_data_for_ids(ids, data, true, bridge)) {
+            send_long_poll_busy(res);
+            return;
+        }
 
-        std::string name = req.get_param_value("name");
-        nlohmann::json j;
+        // Binary encodings address values by their position in the ID list instead of by UUID
+        data_encoding encoding = get_data_encoding(req);
 
-        // Return all logs (without data) if no name is provided
-        if (name.empty()) {
-            j = nlohmann::json::array();
+        if (encoding != data_encoding::JSON) {
+            std::vector<std::pair<uint16_t, value_sample>> samples;
 
-            // Go through all logs in map and add them to the JSON array
-            for (const auto &log : logs) {
-                nlohmann::json log_j = log.second;
-                j.push_back(log_j);
+            for (size_t i = 0; i < ids.size(); i++) {
+                samples.emplace_back(i, data.at(ids[i]));
             }
 
-            res.set_content(j.dump(), "application/json");
-            return;            
-        }
-
-        // Check if log exists
-        if (logs.find(name) == logs.end()) {
-            j["error"] = "Log not found";
-            res.status = 404;
-            res.set_content(j.dump(), "application/json");
+            res.set_content(encode_data(samples, encoding), get_data_content_type(encoding));
             return;
         }
 
-        // Return log data
-        try {
-            j = logs[name];
-            j["data"] = logs[name].get_csv_string();
+        // With age=true, each value comes with the time since it was received and a stale flag
+        if (req.has_param("age") && req.get_param_value("age") == "true") {
+            to_json(j, data);
         }
-        catch (const std::exception &e) {
-            j["error"] = e.what();
-            res.status = 500;
-            res.set_content(j.dump(), "application/json");
-            return;
+        else {
+            std::unordered_map<UUIDv4::UUID, float> values;
+
+            for (const auto &d : data) {
+                values[d.first] = d.second.value;
+            }
+
+            to_json(j, values);
         }
 
         res.set_content(j.dump(), "application/json");
     }
 
-    void server::handle_post_log(const httplib::Request &req, httplib::Response &res) {
+    void server::handle_get_data_stream(const httplib::Request &req, httplib::Response &res) {
         set_cors_headers(res);
 
-        nlohmann::json res_body;
+        nlohmann::json j;
+        auto first_it = req.params.find("id");
+        auto sub_it = req.params.find("sub");
 
-        if (req.body.empty()) {
-            res_body["error"] = "Missing request body";
+        if (first_it == req.params.end() && sub_it == req.params.end()) {
+            j["error"] = "Missing parameter 'id'";
             res.status = 400;
-            res.set_content(res_body.dump(), "application/json");
+            res.set_content(j.dump(), "application/json");
             return;
         }
 
-        nlohmann::json req_body = nlohmann::json::parse(req.body);
-        bool log_raw = false;
-        auto body_it = req_body.find("stop");
+        // Resolve everything once, updates only read the value slots. 
+        // The requests stay leased for as long as the client is connected
+        auto stream = std::make_shared<data_stream>();
+        std::vector<std::shared_ptr<const request>> stream_requests;
 
-        if (body_it != req_body.end()) {
-            std::string name = body_it->template get<std::string>();
-            stop_log(name);
+        if (sub_it != req.params.end()) {
+            auto sub = find_subscription(sub_it->second);
 
-            res.status = 204;
-            return;
-        }
+            if (!sub) {
+                j["error"] = "Subscription not found";
+                res.status = 404;
+                res.set_content(j.dump(), "application/json");
+                return;
+            }
 
-        // Get dashboard to log
-        body_it = req_body.find("dashboard");
+            // Check every ID before leasing any of them, the vehicles may have been reloaded since
+            try {
+                for (size_t i = 0; i < sub->ids.size(); i++) {
+                    stream_requests.push_back(get_request(sub->ids[i]));
+                    stream->entries.push_back({ sub->ids[i], sub->bridges[i], 0, 0.0f, false });
+                }
+            }
+            catch (const std::exception &e) {
+                j["error"] = "Request not found";
+                res.status = 404;
+                res.set_content(j.dump(), "application/json");
+                return;
+            }
 
-        if (body_it == req_body.end()) {
-            res_body["error"] = "Missing parameter 'dashboard'";
-            res.status = 400;
-            return res.set_content(res_body.dump(), "application/json");
+            stream->bridge = sub->bridge;
         }
+        else {
+            obd2_bridge *bridge = nullptr;
 
-        UUIDv4::UUID dashboard_id = body_it->template get<UUIDv4::UUID>();
+            if (req.has_param("bus") && (bridge = get_selected_bridge(req, res)) == nullptr) {
+                return;
+            }
 
-        // Check if dashboard exists
-        auto it = dashboards.find(dashboard_id);
+            // Check every ID before leasing any of them
+            try {
+                for (const auto &id : split_ids(first_it->second, ',')) {
+                    obd2_bridge &b = bridge ? *bridge : get_request_bridge(id);
 
-        if (it == dashboards.end()) {
-            res_body["error"] = "Dashboard not found";
-            res.status = 404;
-            return res.set_content(res_body.dump(), "application/json");
+                    stream_requests.push_back(get_request(id));
+                    stream->entries.push_back({ id, &b, 0, 0.0f, false });
+                }
+            }
+            catch (const std::exception &e) {
+                j["error"] = "Request not found";
+                res.status = 404;
+                res.set_content(j.dump(), "application/json");
+                return;
+            }
+
+            stream->bridge = bridge ? bridge : (stream->entries.empty() ? obd2 : stream->entries.front().bridge);
         }
 
-        // Check if should log raw
-        body_it = req_body.find("raw");
+        // The slot is only known once the request is registered on its bridge
+        for (size_t i = 0; i < stream->entries.size(); i++) {
+            auto &e = stream->entries[i];
 
-        if (body_it != req_body.end()) {
-            log_raw = body_it->get<bool>();
+            e.bridge->acquire_request(*stream_requests[i]);
+            e.slot = e.bridge->get_request_slot(e.id);
         }
 
-        std::string log_name;
-    
-        try {
-            log_name = create_log(dashboard_id, log_raw);
-        }
-        catch(const std::exception &e) {
-            res_body["error"] = e.what();
-            res.status = 500;
-            return res.set_content(res_body.dump(), "application/json");
+        // A stream occupies its worker for as long as it is open
+        if (!try_begin_long_poll()) {
+            for (const auto &e : stream->entries) {
+                e.bridge->release_request(e.id);
+            }
+
+            streams_rejected++;
+            j["error"] = "Too many open streams";
+            res.status = 503;
+            res.set_header("Retry-After", "5");
+            res.set_content(j.dump(), "application/json");
+            return;
         }
 
-        res_body["name"] = log_name;
-        res.set_content(res_body.dump(), "application/json");
-    }
+        stream->epoch = stream->bridge->get_refresh_epoch();
+        stream->encoding = get_data_encoding(req);
+
+        // Binary streams are a plain sequence of updates in the negotiated encoding
+        std::string content_type = stream->encoding == data_encoding::JSON 
+            ? "text/event-stream" 
+            : get_data_content_type(stream->encoding);
+
+        res.set_header("Cache-Control", "no-cache");
+        res.set_chunked_content_provider(
+            content_type,
+            [this, stream](size_t offset, httplib::DataSink &sink) {
+                uint64_t epoch = stream->bridge->await_new_data(stream->epoch, STREAM_KEEPALIVE_INTERVAL);
+                std::vector<std::pair<uint16_t, value_sample>> samples;
+
+                // A comment or an empty update keeps idle connections open and detects clients that went away
+                if (epoch == stream->epoch) {
+                    const std::string keepalive = stream->encoding == data_encoding::JSON 
+                        ? ": keepalive\n\n" 
+                        : encode_data(samples, stream->encoding);
+                    return sink.write(keepalive.data(), keepalive.size());
+                }
 
-    void server::handle_get_config(const httplib::Request &req, httplib::Response &res) {
-        set_cors_headers(res);
+                stream->epoch = epoch;
+                nlohmann::json update = nlohmann::json::object();
 
-        nlohmann::json j;
+                // After the first update, only values that changed are sent
+                for (size_t i = 0; i < stream->entries.size(); i++) {
+                    auto &e = stream->entries[i];
+                    value_sample sample = e.bridge->get_slot_sample(e.slot);
+                    float value = sample.value;
+                    bool unchanged = value == e.last_value || (std::isnan(value) && std::isnan(e.last_value));
 
-        j["obd2_refresh_ms"] = get_obd2_refresh_ms();
+                    if (e.sent && unchanged) {
+                        continue;
+                    }
 
-        res.set_content(j.dump(), "application/json");
+                    if (stream->encoding == data_encoding::JSON) {
+                        update[e.id.str()] = value;
+                    }
+
+                    samples.emplace_back(i, sample);
+                    e.last_value = value;
+                    e.sent = true;
+                }
+
+                if (samples.empty()) {
+                    return true;
+                }
+
+                const std::string event = stream->encoding == data_encoding::JSON 
+                    ? "data: " + update.dump() + "\n\n" 
+                    : encode_data(samples, stream->encoding);
+                return sink.write(event.data(), event.size());
+            },
+            [this, stream](bool success) {
+                for (const auto &e : stream->entries) {
+                    e.bridge->release_request(e.id);
+                }
+
+                end_long_poll();
+            }
+        );
     }
 
-    void server::handle_put_config(const httplib::Request &req, httplib::Response &res) {
-        set_cors_headers(res);
+    void server::handle_get_subscription_data(const httplib::Request &req, httplib::Response &res) {
+        nlohmann::json j;
+        auto sub = find_subscription(req.get_param_value("sub"));
 
-        nlohmann::json res_body;
+        if (!sub) {
+            j["error"] = "Subscription not found";
+            res.status = 404;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
 
-        if (req.body.empty()) {
-            res_body["error"] = "Missing request body";
-            res.status = 400;
-            res.set_content(res_body.dump(), "application/json");
+        if (req.has_param("since")) {
+            send_data_since(req, res, sub->bridges, sub->slots, sub->keys, *sub->bridge);
             return;
         }
 
-        nlohmann::json config_body = nlohmann::json::parse(req.body);
-        auto it = config_body.find("obd2_refresh_ms");
+        uint64_t epoch = sub->bridge->get_refresh_epoch();
 
-        if (it != config_body.end()) {
-            set_obd2_refresh_ms(it->template get<uint32_t>());
+        if (!await_long_poll(*sub->bridge, epoch)) {
+            send_long_poll_busy(res);
+            return;
+        }
+
+        std::vector<std::pair<uint16_t, value_sample>> samples;
+        samples.reserve(sub->slots.size());
+
+        for (size_t i = 0; i < sub->slots.size(); i++) {
+            samples.emplace_back(i, sub->bridges[i]->get_slot_sample(sub->slots[i]));
+        }
+
+        data_encoding encoding = get_data_encoding(req);
+
+        if (encoding != data_encoding::JSON) {
+            res.set_content(encode_data(samples, encoding), get_data_content_type(encoding));
+            return;
+        }
+
+        // Same shape as for an ID list, with the keys prepared at subscription time
+        const bool with_age = req.has_param("age") && req.get_param_value("age") == "true";
+        j = get_samples_json(samples, sub->keys, with_age);
+
+        res.set_content(j.dump(), "application/json");
+    }
+
+    void server::send_data_since(const httplib::Request &req, httplib::Response &res, 
+        const std::vector<obd2_bridge *> &slot_bridges, const std::vector<size_t> &slots, 
+        const std::vector<std::string> &keys, obd2_bridge &bridge) {
+        nlohmann::json j;
+        uint64_t since;
+
+        try {
+            since = std::stoull(req.get_param_value("since"));
+        }
+        catch (const std::exception &e) {
+            j["error"] = "Invalid parameter 'since'";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        // Clients that fell behind skip straight to the current state, 
+        // only a client that is up to date waits for the next refresh
+        uint64_t epoch = bridge.get_refresh_epoch();
+
+        if (since == epoch && !await_long_poll(bridge, epoch)) {
+            send_long_poll_busy(res);
+            return;
+        }
+
+        // An epoch from the future was handed out before a restart, so the client gets everything. 
+        // Values of other buses are not covered by the epoch and are always included
+        std::vector<std::pair<uint16_t, value_sample>> samples;
+
+        for (size_t i = 0; i < slots.size(); i++) {
+            uint64_t changed_epoch = slot_bridges[i]->get_slot_changed_epoch(slots[i]);
+
+            if (since > epoch || slot_bridges[i] != &bridge || changed_epoch > since) {
+                samples.emplace_back(i, slot_bridges[i]->get_slot_sample(slots[i]));
+            }
+        }
+
+        data_encoding encoding = get_data_encoding(req);
+        res.set_header("X-Data-Epoch", std::to_string(epoch));
+
+        if (encoding != data_encoding::JSON) {
+            res.set_content(encode_data(samples, encoding), get_data_content_type(encoding));
+            return;
+        }
+
+        const bool with_age = req.has_param("age") && req.get_param_value("age") == "true";
+
+        j["epoch"] = epoch;
+        j["data"] = get_samples_json(samples, keys, with_age);
+
+        res.set_content(j.dump(), "application/json");
+    }
+
+    void server::handle_post_subscription(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json res_body;
+
+        if (req.body.empty()) {
+            res_body["error"] = "Missing request body";
+            res.status = 400;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        nlohmann::json sub_body = nlohmann::json::parse(req.body);
+        auto body_it = sub_body.find("ids");
+
+        if (body_it == sub_body.end() || !body_it->is_array() || body_it->size() > std::numeric_limits<uint16_t>::max()) {
+            res_body["error"] = "Missing parameter 'ids'";
+            res.status = 400;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        obd2_bridge *bridge = nullptr;
+
+        if (req.has_param("bus") && (bridge = get_selected_bridge(req, res)) == nullptr) {
+            return;
+        }
+
+        auto sub = std::make_shared<subscription>();
+        std::vector<std::shared_ptr<const request>> sub_requests;
+
+        // Check every ID before leasing any of them
+        try {
+            for (const auto &id_j : *body_it) {
+                UUIDv4::UUID id = UUIDv4::UUID::fromStrFactory(id_j.get<std::string>());
+
+                sub_requests.push_back(get_request(id));
+                sub->ids.push_back(id);
+                sub->keys.push_back(id.str());
+            }
+        }
+        catch (const std::exception &e) {
+            res_body["error"] = "Request not found";
+            res.status = 404;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        for (size_t i = 0; i < sub->ids.size(); i++) {
+            obd2_bridge &b = bridge ? *bridge : get_request_bridge(sub->ids[i]);
+
+            b.acquire_request(*sub_requests[i]);
+            sub->bridges.push_back(&b);
+            sub->slots.push_back(b.get_request_slot(sub->ids[i]));
+        }
+
+        sub->bridge = bridge ? bridge : (sub->bridges.empty() ? obd2 : sub->bridges.front());
+        sub->last_used = std::chrono::steady_clock::now().time_since_epoch().count();
+
+        std::string handle;
+
+        {
+            std::lock_guard<std::mutex> subscriptions_lock(subscriptions_mutex);
+
+            do {
+                std::stringstream ss;
+                ss << std::hex << std::setw(16) << std::setfill('0') << subscription_rng();
+                handle = ss.str();
+            } while (subscriptions.find(handle) != subscriptions.end());
+
+            subscriptions.try_emplace(handle, sub);
+        }
+
+        res_body["handle"] = handle;
+        res_body["ttl_ms"] = SUBSCRIPTION_TTL.count();
+        res.set_content(res_body.dump(), "application/json");
+    }
+
+    void server::handle_delete_subscription(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json res_body;
+        std::shared_ptr<subscription> sub;
+        auto it_handle = req.path_params.find("handle");
+
+        if (it_handle == req.path_params.end()) {
+            res_body["error"] = "Missing parameter 'handle'";
+            res.status = 400;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> subscriptions_lock(subscriptions_mutex);
+            auto it = subscriptions.find(it_handle->second);
+
+            if (it != subscriptions.end()) {
+                sub = it->second;
+                subscriptions.erase(it);
+            }
+        }
+
+        if (!sub) {
+            res_body["error"] = "Subscription not found";
+            res.status = 404;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        release_subscription(*sub);
+        res.status = 204;
+    }
+
+    void server::handle_get_dtcs(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        obd2_bridge *bridge = get_selected_bridge(req, res);
+
+        if (bridge == nullptr) {
+            return;
+        }
+
+        auto dtcs = bridge->get_dtcs();   
+        nlohmann::json j = dtcs;
+
+        res.set_content(j.dump(), "application/json");
+    }
+
+    void server::handle_delete_dtcs(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        obd2_bridge *bridge = get_selected_bridge(req, res);
+
+        if (bridge == nullptr) {
+            return;
+        }
+
+        bridge->clear_dtcs();
+        res.status = 204;
+    }
+
+    void server::handle_get_log(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        std::string name = req.get_param_value("name");
+        nlohmann::json j;
+
+        // Return all logs (without data) if no name is provided
+        if (name.empty()) {
+            j = nlohmann::json::array();
+
+            // Go through all logs in map and add them to the JSON array
+            for (const auto &log : *logs.load()) {
+                nlohmann::json log_j = *log.second;
+                j.push_back(log_j);
+            }
+
+            res.set_content(j.dump(), "application/json");
+            return;            
+        }
+
+        // Check if log exists
+        auto current_logs = logs.load();
+        auto it_log = current_logs->find(name);
+
+        if (it_log == current_logs->end()) {
+            j["error"] = "Log not found";
+            res.status = 404;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        const data_log &log = *it_log->second;
+
+        // Inlining the CSV into JSON costs several copies of the file, large logs are only streamed
+        if (log.get_data_size() > MAX_INLINE_LOG_SIZE) {
+            j["error"] = "Log too large, download it from /logs/" + name + "/csv";
+            j["csv_url"] = "/logs/" + name + "/csv";
+            j["raw_url"] = "/logs/" + name + "/raw";
+            res.status = 413;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        content_encoding encoding = select_content_encoding(req.get_header_value("Accept-Encoding"));
+
+        // Closed logs do not change anymore, they are compressed once and kept next to the CSV file
+        if (!log.get_is_logging() && encoding != content_encoding::NONE) {
+            try {
+                res.set_header("Vary", "Accept-Encoding");
+                set_encoded_content(res, get_compressed_log(log, encoding), encoding);
+                return;
+            }
+            catch (const std::exception &e) {
+                std::cerr << "Could not compress log " << name << ": " << e.what() << std::endl;
+            }
+        }
+
+        // Return log data
+        try {
+            j = log;
+            j["data"] = log.get_csv_string();
+        }
+        catch (const std::exception &e) {
+            j["error"] = e.what();
+            res.status = 500;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        res.set_content(j.dump(), "application/json");
+    }
+
+    void server::handle_get_log_raw(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json j;
+        auto it_name = req.path_params.find("name");
+
+        if (it_name == req.path_params.end()) {
+            j["error"] = "Missing parameter 'name'";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        auto current_logs = logs.load();
+        auto it_log = current_logs->find(it_name->second);
+
+        if (it_log == current_logs->end()) {
+            j["error"] = "Log not found";
+            res.status = 404;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        // Files are served as they are stored, one segment at a time
+        std::vector<log_segment> segments = it_log->second->get_segments();
+        auto it_segment = segments.begin();
+
+        if (req.has_param("segment")) {
+            const std::string index = req.get_param_value("segment");
+
+            it_segment = std::find_if(segments.begin(), segments.end(), [&index](const log_segment &s) {
+                return std::to_string(s.index) == index;
+            });
+        }
+
+        if (it_segment == segments.end()) {
+            j["error"] = "Segment not found";
+            res.status = 404;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        send_log_file(*it_segment, res);
+    }
+
+    void server::handle_get_log_csv(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json j;
+        auto it_name = req.path_params.find("name");
+
+        if (it_name == req.path_params.end()) {
+            j["error"] = "Missing parameter 'name'";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        auto current_logs = logs.load();
+        auto it_log = current_logs->find(it_name->second);
+
+        if (it_log == current_logs->end()) {
+            j["error"] = "Log not found";
+            res.status = 404;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        std::shared_ptr<data_log> log = it_log->second;
+        std::vector<log_segment> segments = log->get_segments();
+
+        // A single uncompressed CSV file keeps Range support
+        if (log->get_format() == log_format::CSV && segments.size() == 1 
+            && segments.front().encoding == content_encoding::NONE) {
+            send_log_file(segments.front(), res);
+            return;
+        }
+
+        res.set_header("Content-Disposition", "attachment; filename=\"" + log->get_name() + ".csv\"");
+
+        // Segments are converted or decompressed piece by piece, the CSV is never held in memory as a whole. 
+        // Everything is written in the first call, sink.write() blocks while the client is behind
+        res.set_chunked_content_provider(
+            "text/csv",
+            [log](size_t offset, httplib::DataSink &sink) {
+                try {
+                    if (!log->write_csv([&sink](const char *data, size_t size) { return sink.write(data, size); })) {
+                        return false;
+                    }
+                }
+                catch (const std::exception &e) {
+                    std::cerr << "Could not export log " << log->get_name() << ": " << e.what() << std::endl;
+                    return false;
+                }
+
+                sink.done();
+                return true;
+            }
+        );
+    }
+
+    void server::handle_get_log_series(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json j;
+        auto it_name = req.path_params.find("name");
+
+        if (it_name == req.path_params.end()) {
+            j["error"] = "Missing parameter 'name'";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        auto current_logs = logs.load();
+        auto it_log = current_logs->find(it_name->second);
+
+        if (it_log == current_logs->end()) {
+            j["error"] = "Log not found";
+            res.status = 404;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        std::shared_ptr<data_log> log = it_log->second;
+
+        if (log->get_is_raw()) {
+            j["error"] = "Raw logs have no values";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        auto it_id = req.params.find("id");
+
+        if (it_id == req.params.end()) {
+            j["error"] = "Missing parameter 'id'";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        // The range is limited to the time the log covers, so bucketing never sees extreme values
+        const int64_t log_from_ms = std::chrono::duration_cast<std::chrono::milliseconds>(log->get_start_time().time_since_epoch()).count();
+        const int64_t log_to_ms = std::chrono::duration_cast<std::chrono::milliseconds>(log->get_end_time().time_since_epoch()).count() + 1;
+        int64_t from_ms, to_ms;
+        size_t buckets;
+
+        try {
+            from_ms = req.has_param("from") ? std::max<int64_t>(std::stoll(req.get_param_value("from")), log_from_ms) : log_from_ms;
+            to_ms = req.has_param("to") ? std::min<int64_t>(std::stoll(req.get_param_value("to")), log_to_ms) : log_to_ms;
+            buckets = req.has_param("buckets") ? std::stoul(req.get_param_value("buckets")) : LOG_SERIES_DEFAULT_BUCKETS;
+        }
+        catch (const std::exception &e) {
+            j["error"] = "Invalid parameter 'from', 'to' or 'buckets'";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        if (to_ms <= from_ms || buckets == 0) {
+            j["error"] = "Empty range";
+            res.status = 400;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        buckets = std::min(buckets, LOG_SERIES_MAX_BUCKETS);
+
+        // Stopped logs never change, so their series are only computed once
+        const bool cacheable = !log->get_is_logging();
+        const std::string cache_key = log->get_name() + "?" + it_id->second + "&" + std::to_string(from_ms) 
+            + "&" + std::to_string(to_ms) + "&" + std::to_string(buckets);
+
+        if (cacheable) {
+            std::shared_ptr<const response_cache::entry> cached;
+
+            {
+                std::lock_guard<std::mutex> series_lock(log_series_cache_mutex);
+                auto it = log_series_cache.find(cache_key);
+
+                if (it != log_series_cache.end()) {
+                    cached = it->second;
+                }
+            }
+
+            if (cached) {
+                send_cached(req, res, *cached);
+                return;
+            }
+        }
+
+        try {
+            std::vector<UUIDv4::UUID> ids = split_ids(it_id->second, ',');
+            const std::vector<UUIDv4::UUID> &log_ids = log->get_request_ids();
+            std::vector<std::string> columns = log->get_columns();
+            std::vector<std::string> keys;
+            std::vector<size_t> indices;
+
+            // Logs loaded from disk only know their column names, which are derived from the requests
+            for (const auto &id : ids) {
+                auto it_column = std::find(log_ids.begin(), log_ids.end(), id);
+                size_t index = it_column - log_ids.begin();
+
+                if (it_column == log_ids.end()) {
+                    std::shared_ptr<const request> r;
+
+                    try {
+                        r = get_request(id);
+                    }
+                    catch (const std::exception &e) { }
+
+                    std::string column = r ? get_log_column_name(*r, false) : "";
+                    index = std::find(columns.begin(), columns.end(), column) - columns.begin();
+                }
+
+                if (index >= columns.size()) {
+                    j["error"] = "Request not found in log [" + id.str() + "]";
+                    res.status = 404;
+                    res.set_content(j.dump(), "application/json");
+                    return;
+                }
+
+                keys.push_back(id.str());
+                indices.push_back(index);
+            }
+
+            log_series series(keys, from_ms, to_ms, buckets);
+
+            log->scan_values(indices, from_ms, to_ms, [&series](int64_t time_ms, const std::vector<float> &values) {
+                return series.add(time_ms, values);
+            });
+
+            nlohmann::json series_j = series;
+
+            if (!cacheable) {
+                res.set_content(series_j.dump(), "application/json");
+                return;
+            }
+
+            auto entry = response_cache::make_entry(series_j.dump());
+
+            {
+                std::lock_guard<std::mutex> series_lock(log_series_cache_mutex);
+
+                if (log_series_cache.try_emplace(cache_key, entry).second) {
+                    log_series_cache_order.push_back(cache_key);
+                }
+
+                while (log_series_cache_order.size() > LOG_SERIES_CACHE_SIZE) {
+                    log_series_cache.erase(log_series_cache_order.front());
+                    log_series_cache_order.pop_front();
+                }
+            }
+
+            send_cached(req, res, *entry);
+        }
+        catch (const std::exception &e) {
+            j["error"] = e.what();
+            res.status = 500;
+            res.set_content(j.dump(), "application/json");
+        }
+    }
+
+    void server::send_log_file(const log_segment &segment, httplib::Response &res) {
+        nlohmann::json j;
+        bool is_csv = segment.encoding == content_encoding::NONE 
+            && std::filesystem::path(segment.path).extension() == get_log_extension(log_format::CSV);
+        const char *content_type = is_csv ? "text/csv" : "application/octet-stream";
+
+        int fd = open(segment.path.c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+
+        if (fd < 0 || fstat(fd, &st) < 0) {
+            j["error"] = std::strerror(errno);
+            res.status = 500;
+            res.set_content(j.dump(), "application/json");
+
+            if (fd >= 0) {
+                close(fd);
+            }
+
+            return;
+        }
+
+        res.set_header("Accept-Ranges", "bytes");
+        res.set_header("Content-Disposition", 
+            "attachment; filename=\"" + std::filesystem::path(segment.path).filename().string() + "\"");
+
+        // Running logs are served up to their size at the time of the request
+        size_t size = st.st_size;
+
+        if (size == 0) {
+            close(fd);
+            res.set_content("", content_type);
+            return;
+        }
+
+        // The mapping is written to the socket directly, so the file is never copied into the heap. 
+        // httplib serves Range requests by asking the provider for the requested offsets only
+        void *map = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+
+        if (map == MAP_FAILED) {
+            j["error"] = std::strerror(errno);
+            res.status = 500;
+            res.set_content(j.dump(), "application/json");
+            return;
+        }
+
+        madvise(map, size, MADV_SEQUENTIAL);
+
+        res.set_content_provider(
+            size,
+            content_type,
+            [map](size_t offset, size_t length, httplib::DataSink &sink) {
+                return sink.write(static_cast<const char *>(map) + offset, std::min(length, LOG_STREAM_CHUNK_SIZE));
+            },
+            [map, size](bool success) {
+                munmap(map, size);
+            }
+        );
+    }
+
+    void server::handle_post_log(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json res_body;
+
+        if (req.body.empty()) {
+            res_body["error"] = "Missing request body";
+            res.status = 400;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        nlohmann::json req_body = nlohmann::json::parse(req.body);
+        bool log_raw = false;
+        log_format format = get_log_format();
+        auto body_it = req_body.find("stop");
+
+        if (body_it != req_body.end()) {
+            std::string name = body_it->template get<std::string>();
+            stop_log(name);
+
+            res.status = 204;
+            return;
+        }
+
+        // Get dashboard to log
+        body_it = req_body.find("dashboard");
+
+        if (body_it == req_body.end()) {
+            res_body["error"] = "Missing parameter 'dashboard'";
+            res.status = 400;
+            return res.set_content(res_body.dump(), "application/json");
+        }
+
+        UUIDv4::UUID dashboard_id = body_it->template get<UUIDv4::UUID>();
+
+        // Check if dashboard exists
+        auto current_dashboards = dashboards.load();
+
+        if (current_dashboards->find(dashboard_id) == current_dashboards->end()) {
+            res_body["error"] = "Dashboard not found";
+            res.status = 404;
+            return res.set_content(res_body.dump(), "application/json");
+        }
+
+        // Check if should log raw
+        body_it = req_body.find("raw");
+
+        if (body_it != req_body.end()) {
+            log_raw = body_it->get<bool>();
+        }
+
+        std::string log_name;
+    
+        try {
+            // The configured format can be overridden per log
+            body_it = req_body.find("format");
+
+            if (body_it != req_body.end()) {
+                format = body_it->template get<log_format>();
+            }
+
+            log_name = create_log(dashboard_id, log_raw, format);
+        }
+        catch(const std::exception &e) {
+            res_body["error"] = e.what();
+            res.status = 500;
+            return res.set_content(res_body.dump(), "application/json");
+        }
+
+        res_body["name"] = log_name;
+        res.set_content(res_body.dump(), "application/json");
+    }
+
+    void server::handle_get_config(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json j;
+
+        j["obd2_refresh_ms"] = get_obd2_refresh_ms();
+
+        res.set_content(j.dump(), "application/json");
+    }
+
+    void server::handle_put_config(const httplib::Request &req, httplib::Response &res) {
+        set_cors_headers(res);
+
+        nlohmann::json res_body;
+
+        if (req.body.empty()) {
+            res_body["error"] = "Missing request body";
+            res.status = 400;
+            res.set_content(res_body.dump(), "application/json");
+            return;
+        }
+
+        nlohmann::json config_body = nlohmann::json::parse(req.body);
+        auto it = config_body.find("obd2_refresh_ms");
+
+        if (it != config_body.end()) {
+            set_obd2_refresh_ms(it->template get<uint32_t>());
         }
 
         save_server_config();
@@ -585,16 +1584,46 @@ namespace obd2_server {
         set_cors_headers(res);
 
         nlohmann::json j;
+        obd2_bridge *bridge = get_selected_bridge(req, res);
+
+        if (bridge == nullptr) {
+            return;
+        }
 
-        j["vehicle_connected"] = obd2->get_is_connected();
+        j["vehicle_connected"] = bridge->get_is_connected();
+        j["vin"] = bridge->get_vin();
+
+        j["http"] = http_metrics;
+        j["http"]["long_polls_active"] = long_polls_active.load();
+        j["http"]["long_polls_degraded"] = long_polls_degraded.load();
+        j["http"]["streams_rejected"] = streams_rejected.load();
+
+        // Rows the log writer could not keep up with
+        uint64_t log_overruns = 0;
+
+        for (const auto &log : *logs.load()) {
+            log_overruns += log.second->get_overruns();
+        }
+
+        j["log_overruns"] = log_overruns;
+
+        // Without a bus selector, also report every configured bus
+        if (!req.has_param("bus")) {
+            j["buses"] = nlohmann::json::object();
+
+            for (const auto &b : bridges) {
+                j["buses"][b.first] = b.second->get_is_connected();
+            }
+        }
 
         res.set_content(j.dump(), "application/json");
     }
 
-    std::string server::create_log(const UUIDv4::UUID &dashboard_id, bool log_raw) {
-        auto it = dashboards.find(dashboard_id);
+    std::string server::create_log(const UUIDv4::UUID &dashboard_id, bool log_raw, log_format format) {
+        auto current_dashboards = dashboards.load();
+        auto it = current_dashboards->find(dashboard_id);
 
-        if (it == dashboards.end()) {
+        if (it == current_dashboards->end()) {
             throw std::runtime_error("Dashboard not found [" + dashboard_id.str() + "]");
         }
 
@@ -603,80 +1632,268 @@ namespace obd2_server {
 
         // Create map of request IDs to names (for log header)
         for (const request_entry &entry : d.get_requests()) {
-            const auto &req = get_request(entry.req_id);
-        
-            // Use special format for raw logs (ECU:Service:PID)
-            if (log_raw) {
-                std::stringstream ss;
+            requests[entry.req_id] = get_log_column_name(*get_request(entry.req_id), log_raw);
+        }
 
-                ss << std::hex << std::setfill('0')
-                   << std::setw(3) << req.ecu << ":" 
-                   << std::setw(2) << static_cast<uint16_t>(req.service) << ":" 
-                   << std::setw(2) << req.pid; 
+        // Rows are written on refreshes of the first request's bus
+        const std::string &bus = d.get_requests().empty() 
+            ? obd2_can_device 
+            : get_request_bus(d.get_requests().front().req_id);
 
-                requests[entry.req_id] = ss.str();
-            }
-            else {
-                requests[entry.req_id] = req.name;
+        // The ring holds a few flush intervals worth of rows of that bus
+        auto bridge_it = bridges.find(bus);
+        uint32_t refresh_ms = bridge_it != bridges.end() ? bridge_it->second->get_can_refresh_ms() : get_obd2_refresh_ms();
+        size_t ring_capacity = std::max<size_t>(LOG_RING_MIN_RECORDS, 4 * log_flush_interval_ms / std::max(refresh_ms, 1u));
 
-                if (!req.unit.empty()) { 
-                    requests[entry.req_id] += " (" + req.unit + ")";
-                }
-            }
+        segment_limits limits;
+        limits.max_bytes = log_segment_max_bytes;
+        limits.max_duration = std::chrono::seconds(log_segment_max_s.load());
+
+        auto log = std::make_shared<data_log>(requests, get_logs_dir(), log_raw, format, limits, ring_capacity);
+        std::string log_name = log->get_name();
+
+        // Keep the logged requests polled for as long as the log is running
+        for (const auto &r : requests) {
+            get_request_bridge(r.first).acquire_request(*get_request(r.first));
         }
 
-        data_log log(requests, get_logs_dir(), log_raw);
-        std::string log_name = log.get_name();
-        logs.try_emplace(log_name, std::move(log));
+        // The bus is published first, so the refresh never sees the log without it
+        log_bus_map.update([&](auto &current) {
+            current[log_name] = bus;
+        });
+        logs.update([&](auto &current) {
+            current.try_emplace(log_name, log);
+        });
 
         return log_name;
     }
 
+    std::string server::get_log_column_name(const request &r, bool log_raw) const {
+        // Use special format for raw logs (ECU:Service:PID)
+        if (log_raw) {
+            std::stringstream ss;
+
+            ss << std::hex << std::setfill('0')
+               << std::setw(3) << r.ecu << ":" 
+               << std::setw(2) << static_cast<uint16_t>(r.service) << ":" 
+               << std::setw(2) << r.pid; 
+
+            return ss.str();
+        }
+
+        if (r.unit.empty()) {
+            return r.name;
+        }
+
+        return r.name + " (" + r.unit + ")";
+    }
+
     void server::stop_log(const std::string &name) {
-        auto it = logs.find(name);
+        auto current_logs = logs.load();
+        auto it = current_logs->find(name);
 
-        if (it == logs.end()) {
+        // Only the call that actually stopped the log releases its requests
+        if (it == current_logs->end() || !it->second->stop_logging()) {
             return;
         }
-        
-        it->second.stop_logging();
-    }
 
-    std::unordered_map<UUIDv4::UUID, float> server::get_data_for_ids(const std::vector<UUIDv4::UUID> &ids, bool await_new_data) {
-        std::unordered_map<UUIDv4::UUID, float> data;
+        for (const auto &id : it->second->get_request_ids()) {
+            get_request_bridge(id).release_request(id);
+        }
+    }
 
+    bool server::get_data_for_ids(const std::vector<UUIDv4::UUID> &ids, 
+        std::unordered_map<UUIDv4::UUID, value_sample> &data, bool await_new_data, obd2_bridge *bridge) {
         // First, make sure all requested IDs are registered
         for (const auto &id : ids) {
-            if (!obd2->request_registered(id)) {
-                obd2->register_request(get_request(id));
+            obd2_bridge &b = bridge ? *bridge : get_request_bridge(id);
+
+            if (!b.request_registered(id)) {
+                b.register_request(*get_request(id));
             }
         }
 
         // Then wait for all requests to be processed, if requested
         if (await_new_data) {
-            obd2->await_new_data();
+            obd2_bridge *epoch_bridge = bridge ? bridge : (ids.empty() ? nullptr : &get_request_bridge(ids.front()));
+
+            uint64_t epoch = epoch_bridge ? epoch_bridge->get_refresh_epoch() : 0;
+
+            if (epoch_bridge && !await_long_poll(*epoch_bridge, epoch)) {
+                return false;
+            }
         }
 
         // Finally, get the data
         for (const auto &id : ids) {
-            data[id] = obd2->get_request_val(id);
+            obd2_bridge &b = bridge ? *bridge : get_request_bridge(id);
+            data[id] = b.get_request_sample(id);
         }
 
-        return data;
+        return true;
     }
 
-    std::unordered_map<UUIDv4::UUID, std::vector<uint8_t>> server::get_raw_data_for_ids(const std::vector<UUIDv4::UUID> &ids) {
-        std::unordered_map<UUIDv4::UUID, std::vector<uint8_t>> data;
+    bool server::await_long_poll(obd2_bridge &bridge, uint64_t &epoch) {
+        if (!try_begin_long_poll()) {
+            long_polls_degraded++;
+            return false;
+        }
 
-        for (const auto &id : ids) {
-            if (!obd2->request_registered(id)) {
-                obd2->register_request(get_request(id));
+        epoch = bridge.await_new_data(epoch, LONG_POLL_TIMEOUT);
+        end_long_poll();
+
+        return true;
+    }
+
+    void server::send_long_poll_busy(httplib::Response &res) {
+        // Answering right away with unchanged data would make looping clients spin, 
+        // so they are told to back off instead
+        nlohmann::json j;
+        j["error"] = "Too many waiting requests";
+        res.status = 503;
+        res.set_header("Retry-After", "1");
+        res.set_content(j.dump(), "application/json");
+    }
+
+    server::data_encoding server::get_data_encoding(const httplib::Request &req) const {
+        const std::string accept = req.get_header_value("Accept");
+
+        if (accept.find("application/cbor") != std::string::npos) {
+            return data_encoding::CBOR;
+        }
+
+        if (accept.find("application/msgpack") != std::string::npos 
+            || accept.find("application/x-msgpack") != std::string::npos) {
+            return data_encoding::MSGPACK;
+        }
+
+        if (accept.find("application/octet-stream") != std::string::npos) {
+            return data_encoding::PACKED;
+        }
+
+        return data_encoding::JSON;
+    }
+
+    std::string server::get_data_content_type(data_encoding encoding) const {
+        switch (encoding) {
+            case data_encoding::CBOR:
+                return "application/cbor";
+            case data_encoding::MSGPACK:
+                return "application/msgpack";
+            case data_encoding::PACKED:
+                return "application/octet-stream";
+            default:
+                return "application/json";
+        }
+    }
+
+    std::string server::encode_data(const std::vector<std::pair<uint16_t, value_sample>> &samples, 
+        data_encoding encoding) const {
+        const auto now = std::chrono::system_clock::now();
+        std::string out;
+
+        if (encoding == data_encoding::PACKED) {
+            auto put = [&out](uint32_t v, size_t bytes) {
+                for (size_t i = 0; i < bytes; i++) {
+                    out.push_back(static_cast<char>((v >> (8 * i)) & 0xFF));
+                }
+            };
+
+            out.reserve(2 + samples.size() * 12);
+            put(samples.size(), 2);
+
+            for (const auto &s : samples) {
+                // Values that were never received have the maximum age
+                uint32_t age_ms = std::numeric_limits<uint32_t>::max();
+                uint32_t value_bits;
+
+                if (s.second.timestamp.time_since_epoch().count() != 0) {
+                    auto age = std::chrono::duration_cast<std::chrono::milliseconds>(now - s.second.timestamp).count();
+                    age_ms = std::min<int64_t>(std::max<int64_t>(age, 0), age_ms);
+                }
+
+                std::memcpy(&value_bits, &s.second.value, sizeof(value_bits));
+
+                put(s.first, 2);
+                put(s.second.stale ? 1 : 0, 1);
+                put(0, 1);
+                put(value_bits, 4);
+                put(age_ms, 4);
+            }
+
+            return out;
+        }
+
+        // CBOR and MessagePack carry [index, value, age in ms or null, stale] per record
+        nlohmann::json j = nlohmann::json::array();
+
+        for (const auto &s : samples) {
+            nlohmann::json age = nullptr;
+
+            if (s.second.timestamp.time_since_epoch().count() != 0) {
+                age = std::chrono::duration_cast<std::chrono::milliseconds>(now - s.second.timestamp).count();
+            }
+
+            j.push_back({ s.first, s.second.value, age, s.second.stale });
+        }
+
+        if (encoding == data_encoding::MSGPACK) {
+            nlohmann::json::to_msgpack(j, out);
+        }
+        else {
+            nlohmann::json::to_cbor(j, out);
+        }
+
+        return out;
+    }
+
+    nlohmann::json server::get_samples_json(const std::vector<std::pair<uint16_t, value_sample>> &samples, 
+        const std::vector<std::string> &keys, bool with_age) const {
+        const auto now = std::chrono::system_clock::now();
+        nlohmann::json j = nlohmann::json::object();
+
+        for (const auto &s : samples) {
+            const std::string &key = keys[s.first];
+
+            if (!with_age) {
+                j[key] = s.second.value;
+                continue;
+            }
+
+            j[key] = {
+                {"value", s.second.value},
+                {"stale", s.second.stale},
+                {"age_ms", nullptr}
+            };
+
+            // Values that were never received have no age
+            if (s.second.timestamp.time_since_epoch().count() != 0) {
+                j[key]["age_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(now - s.second.timestamp).count();
             }
+        }
+
+        return j;
+    }
+
+    obd2_bridge *server::get_selected_bridge(const httplib::Request &req, httplib::Response &res) {
+        auto params_it = req.params.find("bus");
 
-            data.try_emplace(id, obd2->get_request_raw(id));
+        if (params_it == req.params.end()) {
+            return obd2;
         }
 
-        return data;
+        auto bridge_it = bridges.find(params_it->second);
+
+        if (bridge_it == bridges.end()) {
+            nlohmann::json j;
+
+            j["error"] = "Bus not found";
+            res.status = 404;
+            res.set_content(j.dump(), "application/json");
+            return nullptr;
+        }
+
+        return bridge_it->second.get();
     }
 
     std::vector<UUIDv4::UUID> server::split_ids(const std::string &s, char delim) {
@@ -698,4 +1915,26 @@ namespace obd2_server {
             j[pair.first.str()] = pair.second;
         }
     }
-}
+
+    void to_json(nlohmann::json& j, const std::unordered_map<UUIDv4::UUID, value_sample>& d) {
+        const auto now = std::chrono::system_clock::now();
+        j = nlohmann::json();
+
+        for (const auto &pair : d) {
+            nlohmann::json sample = {
+                {"value", pair.second.value},
+                {"stale", pair.second.stale}
+            };
+
+            // Values that were never received have no age
+            if (pair.second.timestamp.time_since_epoch().count() != 0) {
+                sample["age_ms"] = std::chrono::duration_cast<std::chrono::milliseconds>(now - pair.second.timestamp).count();
+            }
+            else {
+                sample["age_ms"] = nullptr;
+            }
+
+            j[pair.first.str()] = sample;
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+
+namespace obd2_server {
+    // A value that readers load as an immutable snapshot without locking. 
+    // Writers are serialized and publish a modified copy, so a loaded snapshot never changes
+    template <typename T>
+    class snapshot {
+        public:
+            snapshot() : current(std::make_shared<const T>()) { }
+            snapshot(const snapshot &s) = delete;
+            snapshot(snapshot &&s) = delete;
+
+            snapshot &operator=(const snapshot &s) = delete;
+            snapshot &operator=(snapshot &&s) = delete;
+
+            std::shared_ptr<const T> load() const {
+                return current.load();
+            }
+
+            void store(T value) {
+                std::lock_guard<std::mutex> write_lock(write_mutex);
+                current.store(std::make_shared<const T>(std::move(value)));
+            }
+
+            // Calls modify with a copy of the current value and publishes the copy afterwards. 
+            // Nothing is published if modify throws
+            template <typename F>
+            auto update(F &&modify) {
+                std::lock_guard<std::mutex> write_lock(write_mutex);
+                auto next = std::make_shared<T>(*current.load());
+
+                if constexpr (std::is_void_v<std::invoke_result_t<F, T &>>) {
+                    modify(*next);
+                    current.store(std::move(next));
+                }
+                else {
+                    auto result = modify(*next);
+                    current.store(std::move(next));
+                    return result;
+                }
+            }
+
+        private:
+            std::atomic<std::shared_ptr<const T>> current;
+            std::mutex write_mutex;
+    };
+}
@@ -1,7 +1,7 @@
 #include "request.h"
 
 namespace obd2_server {
-    request::request() : id(UUIDv4::UUIDGenerator<std::mt19937>().getUUID()) { }
+    request::request() : id(UUIDv4::UUIDGenerator<std::mt19937>().getUUID()), refresh_ms(0) { }
 
     bool request::operator==(const request &r) const {
         return id == r.id;
@@ -24,6 +24,10 @@ namespace obd2_server {
             j["min"] = r.min;
             j["max"] = r.max;
         }
+
+        if (r.refresh_ms != 0) {
+            j["refresh_ms"] = r.refresh_ms;
+        }
     }
 
     void from_json(const nlohmann::json& j, request& r) {
@@ -45,5 +49,15 @@ namespace obd2_server {
             r.min = std::numeric_limits<float>::quiet_NaN();
             r.max = std::numeric_limits<float>::quiet_NaN();
         }
+
+        // "refresh_ms" is optional, requests without it are refreshed at the global rate
+        auto it = j.find("refresh_ms");
+
+        if (it != j.end() && !it->is_null()) {
+            r.refresh_ms = it->template get<uint32_t>();
+        }
+        else {
+            r.refresh_ms = 0;
+        }
     }
 }
@@ -22,6 +22,8 @@ namespace obd2_server {
             float min;
             float max;
 
+            uint32_t refresh_ms; // 0 => use the global obd2_refresh_ms
+
             request();
 
             bool operator==(const request &r) const;
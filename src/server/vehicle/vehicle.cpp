@@ -66,6 +66,16 @@ namespace obd2_server {
         throw std::invalid_argument("Request not found");
     }
 
+    const request &vehicle::get_request(const UUIDv4::UUID &id) const {
+        for (const auto &r : requests) {
+            if (r.id == id) {
+                return r;
+            }
+        }
+
+        throw std::invalid_argument("Request not found");
+    }
+
     const std::vector<request> &vehicle::get_requests() const {
         return requests;
     }
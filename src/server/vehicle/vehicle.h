@@ -21,6 +21,7 @@ namespace obd2_server {
             const std::string &get_make() const;
             const std::string &get_model() const;
             request &get_request(const UUIDv4::UUID &id);
+            const request &get_request(const UUIDv4::UUID &id) const;
             const std::vector<request> &get_requests() const;
 
         private: